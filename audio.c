@@ -1,32 +1,37 @@
 #include "lv2h.h"
 
+#define LV2H_AUDIO_SOFTWARE_LATENCY (32.0 / 1000.0)
+
 static void lv2h_audio_callback(struct SoundIoOutStream *outstream, int frame_count_min, int frame_count_max);
 static void lv2h_underflow_callback(struct SoundIoOutStream *outstream);
+static int lv2h_capture_open(lv2h_t *host, struct SoundIo *soundio, struct SoundIoDevice **out_device, struct SoundIoInStream **out_instream);
+static void lv2h_capture_callback(struct SoundIoInStream *instream, int frame_count_min, int frame_count_max);
+static void lv2h_capture_overflow_callback(struct SoundIoInStream *instream);
+static void lv2h_capture_read(lv2h_t *host, int frame_count);
 
-void *lv2h_run_audio(void *arg) {
-    lv2h_t *host;
+int lv2h_soundio_run(lv2h_t *host) {
     struct SoundIoDevice *device;
     struct SoundIoOutStream *outstream;
+    struct SoundIoDevice *in_device;
+    struct SoundIoInStream *instream;
     struct SoundIo *soundio;
     int default_out_device_index;
     int err;
 
-    host = (lv2h_t*)arg;
-
     if (!(soundio = soundio_create())) {
-        LV2H_RETURN_ERR_ARG(host, NULL, "audio: soundio_create\n%s", "");
+        LV2H_RETURN_ERR(host, "audio: soundio_create\n%s", "");
     }
     if ((err = soundio_connect(soundio))) {
-        LV2H_RETURN_ERR_ARG(host, NULL, "audio: soundio_connect: %s\n", soundio_strerror(err));
+        LV2H_RETURN_ERR(host, "audio: soundio_connect: %s\n", soundio_strerror(err));
     }
 
     soundio_flush_events(soundio);
 
     if ((default_out_device_index = soundio_default_output_device_index(soundio)) < 0) {
-        LV2H_RETURN_ERR_ARG(host, NULL, "audio: soundio_default_output_device_index: no output device found\n%s", "");
+        LV2H_RETURN_ERR(host, "audio: soundio_default_output_device_index: no output device found\n%s", "");
     }
     if (!(device = soundio_get_output_device(soundio, default_out_device_index))) {
-        LV2H_RETURN_ERR_ARG(host, NULL, "audio: soundio_get_output_device\n%s", "");
+        LV2H_RETURN_ERR(host, "audio: soundio_get_output_device\n%s", "");
     }
 
     //fprintf(stderr, "Output device: %s\n", device->name);
@@ -35,18 +40,26 @@ void *lv2h_run_audio(void *arg) {
     outstream = soundio_outstream_create(device);
     outstream->format = SoundIoFormatFloat32NE;
     outstream->write_callback = lv2h_audio_callback;
+    outstream->underflow_callback = lv2h_underflow_callback;
     outstream->userdata = host;
     outstream->sample_rate = host->sample_rate;
-    outstream->software_latency = 32.0 / 1000.0;
+    outstream->software_latency = LV2H_AUDIO_SOFTWARE_LATENCY;
 
     if ((err = soundio_outstream_open(outstream))) {
-        LV2H_RETURN_ERR_ARG(host, NULL, "audio: soundio_outstream_open: %s\n", soundio_strerror(err));
+        LV2H_RETURN_ERR(host, "audio: soundio_outstream_open: %s\n", soundio_strerror(err));
     }
     if (outstream->layout_error) {
-        LV2H_RETURN_ERR_ARG(host, NULL, "audio: layout_error: %s\n", soundio_strerror(outstream->layout_error));
+        LV2H_RETURN_ERR(host, "audio: layout_error: %s\n", soundio_strerror(outstream->layout_error));
+    }
+
+    in_device = NULL;
+    instream = NULL;
+    if (host->input_inst && lv2h_capture_open(host, soundio, &in_device, &instream) != LV2H_OK) {
+        return LV2H_ERR;
     }
+
     if ((err = soundio_outstream_start(outstream))) {
-        LV2H_RETURN_ERR_ARG(host, NULL, "audio: soundio_outstream_start: %s\n", soundio_strerror(err));
+        LV2H_RETURN_ERR(host, "audio: soundio_outstream_start: %s\n", soundio_strerror(err));
     }
 
     while (!host->done) {
@@ -54,9 +67,15 @@ void *lv2h_run_audio(void *arg) {
     }
 
     soundio_outstream_destroy(outstream);
+    if (instream) {
+        soundio_instream_destroy(instream);
+        soundio_device_unref(in_device);
+        soundio_ring_buffer_destroy(host->capture_ring);
+        host->capture_ring = NULL;
+    }
     soundio_device_unref(device);
     soundio_destroy(soundio);
-    return NULL;
+    return LV2H_OK;
 }
 
 static void lv2h_audio_callback(struct SoundIoOutStream *outstream, int frame_count_min, int frame_count_max) {
@@ -69,6 +88,9 @@ static void lv2h_audio_callback(struct SoundIoOutStream *outstream, int frame_co
     int frame;
     int frame_count;
     int frames_left;
+    int f, n;
+    long trace_ns;
+    double latency;
 
     (void)frame_count_min;
 
@@ -76,6 +98,17 @@ static void lv2h_audio_callback(struct SoundIoOutStream *outstream, int frame_co
     layout = &outstream->layout;
     frames_left = frame_count_max;
 
+    // The write callback runs on a thread owned by soundio
+    lv2h_rt_enter_thread(host, LV2H_THREAD_AUDIO);
+    trace_ns = LV2H_TRACE_BEGIN(host);
+
+    // Anchor timestamped input to the device: the next frame written,
+    // which may be the tail of a block rendered last time, is heard once
+    // what the device already holds has played
+    if (soundio_outstream_get_latency(outstream, &latency) != SoundIoErrorNone) latency = 0.0;
+    host->clock_frame = host->frame_clock - (host->block_size - host->out_offset);
+    host->clock_ns = lv2h_trace_now_ns() + (long)(latency * 1000000000.0);
+
     // printf("frames_left=%d\n", frames_left);
 
     while (frames_left > 0) {
@@ -88,25 +121,202 @@ static void lv2h_audio_callback(struct SoundIoOutStream *outstream, int frame_co
             break;
         }
 
-        // TODO mutex for data shared by threads
-        lv2h_run_plugin_insts(host, frame_count);
-
-        for (frame = 0; frame < frame_count; frame += 1) {
-            for (channel = 0; channel < layout->channel_count; channel += 1) {
-                sample_ptr = (float*)(areas[channel].ptr + areas[channel].step * frame);
-                *sample_ptr = host->audio_inst->port_array[channel].reader_block_mixed[frame];
+        // The graph only ever runs whole blocks, as promised to plugins by
+        // fixedBlockLength. A write ending mid-block leaves the rest of the
+        // block for the next write.
+        for (frame = 0; frame < frame_count; frame += n) {
+            if (host->out_offset >= host->block_size) {
+                lv2h_process_block(host, host->block_size);
+                host->out_offset = 0;
             }
+            n = host->block_size - host->out_offset;
+            if (n > frame_count - frame) n = frame_count - frame;
+            for (f = 0; f < n; f += 1) {
+                for (channel = 0; channel < layout->channel_count; channel += 1) {
+                    sample_ptr = (float*)(areas[channel].ptr + areas[channel].step * (frame + f));
+                    *sample_ptr = host->audio_inst->port_array[channel].reader_block_mixed[host->out_offset + f];
+                }
+            }
+            host->out_offset += n;
         }
 
         if ((err = soundio_outstream_end_write(outstream))) {
             LV2H_RETURN_ERR_VOID(host, "audio: soundio_outstream_end_write error: %s\n", soundio_strerror(err));
         }
+        if (host->probe_pending > 0) {
+            if (soundio_outstream_get_latency(outstream, &latency) != SoundIoErrorNone) latency = 0.0;
+            lv2h_probe_output(host, (long)(latency * 1000000000.0));
+        }
 
         frames_left -= frame_count;
     }
+
+    LV2H_TRACE_END(host, "audio", NULL, trace_ns);
+}
+
+int lv2h_process_block(lv2h_t *host, int frame_count) {
+    // Timestamped input drained this block is placed against this frame
+    host->block_frame = host->frame_clock;
+    host->block_frames = frame_count;
+    host->frame_clock += frame_count;
+
+    if (host->capture_ring) {
+        lv2h_capture_read(host, frame_count);
+    }
+    // TODO mutex for data shared by threads
+    return lv2h_run_plugin_insts(host, frame_count);
 }
 
 static void lv2h_underflow_callback(struct SoundIoOutStream *outstream) {
-    static int count = 0;
-    fprintf(stderr, "underflow %d\n", count++);
+    lv2h_t *host;
+    unsigned long count;
+    host = (lv2h_t*)outstream->userdata;
+    count = __sync_add_and_fetch(&host->xrun_count, 1);
+    // Trace dump happens off the audio thread in lv2h_run
+    host->trace_xrun_pending = 1;
+    LV2H_LOG(host, LV2H_LOG_WARN, "underflow %lu\n", count);
+}
+
+static int lv2h_capture_open(lv2h_t *host, struct SoundIo *soundio, struct SoundIoDevice **out_device, struct SoundIoInStream **out_instream) {
+    struct SoundIoDevice *device;
+    struct SoundIoInStream *instream;
+    const struct SoundIoChannelLayout *layout;
+    int default_in_device_index;
+    int channel_count;
+    int prefill_bytes;
+    int err;
+
+    channel_count = (int)host->input_plug->port_count;
+
+    if ((default_in_device_index = soundio_default_input_device_index(soundio)) < 0) {
+        LV2H_RETURN_ERR(host, "audio: soundio_default_input_device_index: no input device found\n%s", "");
+    }
+    if (!(device = soundio_get_input_device(soundio, default_in_device_index))) {
+        LV2H_RETURN_ERR(host, "audio: soundio_get_input_device\n%s", "");
+    }
+    if (!(layout = soundio_channel_layout_get_default(channel_count))) {
+        soundio_device_unref(device);
+        LV2H_RETURN_ERR(host, "audio: no channel layout for %d input channels\n", channel_count);
+    }
+
+    instream = soundio_instream_create(device);
+    instream->format = SoundIoFormatFloat32NE;
+    instream->layout = *layout;
+    instream->read_callback = lv2h_capture_callback;
+    instream->overflow_callback = lv2h_capture_overflow_callback;
+    instream->userdata = host;
+    instream->sample_rate = host->sample_rate;
+    instream->software_latency = LV2H_AUDIO_SOFTWARE_LATENCY;
+
+    if ((err = soundio_instream_open(instream))) {
+        soundio_instream_destroy(instream);
+        soundio_device_unref(device);
+        LV2H_RETURN_ERR(host, "audio: soundio_instream_open: %s\n", soundio_strerror(err));
+    }
+
+    // Ring holds interleaved frames. Prefill one software latency worth of
+    // silence so capture and playback stay a constant distance apart.
+    prefill_bytes = (int)(LV2H_AUDIO_SOFTWARE_LATENCY * host->sample_rate) * channel_count * sizeof(float);
+    host->capture_ring = soundio_ring_buffer_create(soundio, prefill_bytes * 4);
+    memset(soundio_ring_buffer_write_ptr(host->capture_ring), 0, prefill_bytes);
+    soundio_ring_buffer_advance_write_ptr(host->capture_ring, prefill_bytes);
+
+    if ((err = soundio_instream_start(instream))) {
+        soundio_ring_buffer_destroy(host->capture_ring);
+        host->capture_ring = NULL;
+        soundio_instream_destroy(instream);
+        soundio_device_unref(device);
+        LV2H_RETURN_ERR(host, "audio: soundio_instream_start: %s\n", soundio_strerror(err));
+    }
+
+    *out_device = device;
+    *out_instream = instream;
+    return LV2H_OK;
+}
+
+static void lv2h_capture_callback(struct SoundIoInStream *instream, int frame_count_min, int frame_count_max) {
+    lv2h_t *host;
+    struct SoundIoChannelArea *areas;
+    float *write_ptr;
+    int channel_count;
+    int free_frames;
+    int frame_count;
+    int frames_left;
+    int frame;
+    int channel;
+    int err;
+
+    (void)frame_count_min;
+
+    host = (lv2h_t*)instream->userdata;
+    channel_count = instream->layout.channel_count;
+    write_ptr = (float*)soundio_ring_buffer_write_ptr(host->capture_ring);
+    free_frames = soundio_ring_buffer_free_count(host->capture_ring) / (channel_count * sizeof(float));
+    frames_left = frame_count_max < free_frames ? frame_count_max : free_frames;
+    if (frames_left < frame_count_max) {
+        __sync_fetch_and_add(&host->capture_overflow_count, 1);
+    }
+
+    while (frames_left > 0) {
+        frame_count = frames_left;
+        if ((err = soundio_instream_begin_read(instream, &areas, &frame_count))) {
+            LV2H_RETURN_ERR_VOID(host, "audio: soundio_instream_begin_read error: %s\n", soundio_strerror(err));
+        }
+        if (frame_count < 1) {
+            break;
+        }
+        if (!areas) {
+            // Hole in the input stream
+            memset(write_ptr, 0, frame_count * channel_count * sizeof(float));
+        } else {
+            for (frame = 0; frame < frame_count; frame += 1) {
+                for (channel = 0; channel < channel_count; channel += 1) {
+                    write_ptr[frame * channel_count + channel] = *(float*)(areas[channel].ptr + areas[channel].step * frame);
+                }
+            }
+        }
+        if ((err = soundio_instream_end_read(instream))) {
+            LV2H_RETURN_ERR_VOID(host, "audio: soundio_instream_end_read error: %s\n", soundio_strerror(err));
+        }
+        soundio_ring_buffer_advance_write_ptr(host->capture_ring, frame_count * channel_count * sizeof(float));
+        write_ptr += frame_count * channel_count;
+        frames_left -= frame_count;
+    }
+}
+
+static void lv2h_capture_overflow_callback(struct SoundIoInStream *instream) {
+    lv2h_t *host;
+    host = (lv2h_t*)instream->userdata;
+    __sync_fetch_and_add(&host->capture_overflow_count, 1);
+}
+
+static void lv2h_capture_read(lv2h_t *host, int frame_count) {
+    lv2h_port_t *port_array;
+    float *read_ptr;
+    int channel_count;
+    int fill_frames;
+    int read_frames;
+    int frame;
+    int channel;
+
+    port_array = host->input_inst->port_array;
+    channel_count = (int)host->input_plug->port_count;
+    read_ptr = (float*)soundio_ring_buffer_read_ptr(host->capture_ring);
+    fill_frames = soundio_ring_buffer_fill_count(host->capture_ring) / (channel_count * sizeof(float));
+    read_frames = frame_count < fill_frames ? frame_count : fill_frames;
+
+    // Deinterleave straight into the capture writer blocks
+    for (channel = 0; channel < channel_count; channel += 1) {
+        for (frame = 0; frame < read_frames; frame += 1) {
+            port_array[channel].writer_block[frame] = read_ptr[frame * channel_count + channel];
+        }
+        if (read_frames < frame_count) {
+            memset(port_array[channel].writer_block + read_frames, 0, (frame_count - read_frames) * sizeof(float));
+        }
+    }
+    if (read_frames < frame_count) {
+        __sync_fetch_and_add(&host->capture_underflow_count, 1);
+    }
+
+    soundio_ring_buffer_advance_read_ptr(host->capture_ring, read_frames * channel_count * sizeof(float));
 }
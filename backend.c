@@ -0,0 +1,159 @@
+#include "lv2h.h"
+#include <errno.h>
+
+static int lv2h_null_run(lv2h_t *host);
+static int lv2h_sink_run(lv2h_t *host);
+static int lv2h_timer_run(lv2h_t *host, int is_sink);
+static int lv2h_sink_write(lv2h_t *host, float *interleaved, int frame_count);
+
+static lv2h_backend_t lv2h_backends[] = {
+    { "soundio", lv2h_soundio_run },
+    { "null",    lv2h_null_run },
+    { "sink",    lv2h_sink_run },
+    { NULL,      NULL }
+};
+
+void *lv2h_run_audio(void *arg) {
+    lv2h_t *host;
+    int rv;
+    host = (lv2h_t*)arg;
+    if (!host->backend) {
+        host->backend = &lv2h_backends[0];
+    }
+    // A backend that gives up takes the host down with it. The result is
+    // also the thread's exit value.
+    if ((rv = (host->backend->run)(host)) != LV2H_OK) {
+        LV2H_LOG(host, LV2H_LOG_ERROR, "%s", host->errstr);
+        host->done = 1;
+    }
+    return (void*)(intptr_t)rv;
+}
+
+int lv2h_set_backend(lv2h_t *host, char *name) {
+    lv2h_backend_t *backend;
+    for (backend = lv2h_backends; backend->name; ++backend) {
+        if (!strcmp(backend->name, name)) {
+            host->backend = backend;
+            return LV2H_OK;
+        }
+    }
+    LV2H_RETURN_ERR(host, "lv2h_set_backend: unknown backend %s\n", name);
+}
+
+int lv2h_set_sink(lv2h_t *host, lv2h_sink_callback_fn callback, void *udata, int fd, int realtime) {
+    host->sink_callback = callback;
+    host->sink_udata = udata;
+    host->sink_fd = fd;
+    host->sink_realtime = realtime;
+    return LV2H_OK;
+}
+
+static int lv2h_null_run(lv2h_t *host) {
+    return lv2h_timer_run(host, 0);
+}
+
+static int lv2h_sink_run(lv2h_t *host) {
+    if (!host->sink_callback && host->sink_fd < 0) {
+        LV2H_RETURN_ERR(host, "audio: sink backend needs a callback or fd (see lv2h_set_sink)\n%s", "");
+    }
+    return lv2h_timer_run(host, 1);
+}
+
+static int lv2h_timer_run(lv2h_t *host, int is_sink) {
+    struct timespec ts;
+    lv2h_port_t *out_ports;
+    float *interleaved;
+    uintmax_t frames_total;
+    long start_ns, deadline_ns, now_ns;
+    int pace;
+    int frame;
+    int channel;
+
+    out_ports = host->audio_inst->port_array;
+    interleaved = NULL;
+    if (is_sink && !(interleaved = calloc(host->block_size * 2, sizeof(float)))) {
+        LV2H_RETURN_ERR(host, "audio: could not allocate sink buffer\n%s", "");
+    }
+    pace = !is_sink || host->sink_realtime;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    start_ns = ts.tv_sec * 1000000000L + ts.tv_nsec;
+    frames_total = 0;
+    host->clock_frame = host->frame_clock;
+    host->clock_ns = start_ns;
+
+    while (!host->done) {
+        lv2h_rt_enter_thread(host, LV2H_THREAD_AUDIO);
+        if (!pace) {
+            // Nothing plays in real time, so each block starts now
+            clock_gettime(CLOCK_MONOTONIC, &ts);
+            host->clock_frame = host->frame_clock;
+            host->clock_ns = ts.tv_sec * 1000000000L + ts.tv_nsec;
+        }
+        lv2h_process_block(host, host->block_size);
+        frames_total += host->block_size;
+
+        if (is_sink) {
+            for (frame = 0; frame < host->block_size; frame += 1) {
+                for (channel = 0; channel < 2; channel += 1) {
+                    interleaved[frame * 2 + channel] = out_ports[channel].reader_block_mixed[frame];
+                }
+            }
+            if (lv2h_sink_write(host, interleaved, host->block_size) != LV2H_OK) {
+                free(interleaved);
+                return LV2H_ERR;
+            }
+        }
+        // No device buffer to account for
+        lv2h_probe_output(host, 0);
+
+        if (!pace) {
+            continue;
+        }
+
+        // Absolute deadlines derived from the frame count do not drift
+        deadline_ns = start_ns + (long)((frames_total * 1000000000ULL) / host->sample_rate);
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        now_ns = ts.tv_sec * 1000000000L + ts.tv_nsec;
+        if (now_ns > deadline_ns) {
+            // Missed the deadline, as a device would underflow. Start the
+            // schedule over from now rather than racing to catch up.
+            __sync_fetch_and_add(&host->xrun_count, 1);
+            host->trace_xrun_pending = 1;
+            start_ns = now_ns;
+            frames_total = 0;
+            host->clock_frame = host->frame_clock;
+            host->clock_ns = now_ns;
+            continue;
+        }
+        ts.tv_sec = deadline_ns / 1000000000L;
+        ts.tv_nsec = deadline_ns % 1000000000L;
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR);
+    }
+
+    if (interleaved) free(interleaved);
+    return LV2H_OK;
+}
+
+static int lv2h_sink_write(lv2h_t *host, float *interleaved, int frame_count) {
+    size_t len, off;
+    ssize_t rv;
+
+    if (host->sink_callback) {
+        if ((host->sink_callback)(host, interleaved, frame_count, 2, host->sink_udata) != LV2H_OK) {
+            LV2H_RETURN_ERR(host, "audio: sink callback failed\n%s", "");
+        }
+        return LV2H_OK;
+    }
+
+    len = frame_count * 2 * sizeof(float);
+    off = 0;
+    while (off < len) {
+        if ((rv = write(host->sink_fd, (char*)interleaved + off, len - off)) < 0) {
+            if (errno == EINTR) continue;
+            LV2H_RETURN_ERR(host, "audio: sink write: %s\n", strerror(errno));
+        }
+        off += rv;
+    }
+    return LV2H_OK;
+}
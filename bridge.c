@@ -0,0 +1,533 @@
+#include "lv2h.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <spawn.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+
+#define LV2H_BRIDGE_ALIGN 64
+#define LV2H_BRIDGE_ATOM_SIZE (sizeof(LV2_Atom_Sequence) + LV2H_SEQUENCE_SIZE)
+#define LV2H_BRIDGE_SPIN 2000
+#define LV2H_BRIDGE_STALL_MS 500
+#define LV2H_BRIDGE_QUIT_MS 200
+#define LV2H_BRIDGE_ARG "--lv2h-bridge"
+#define LV2H_BRIDGE_SHM_FD 3 // fds as seen by the helper
+#define LV2H_BRIDGE_URI_FD 4
+
+extern char **environ;
+
+static int lv2h_bridge_new(lv2h_inst_t *inst, long timeout_us);
+static int lv2h_bridge_spawn(lv2h_bridge_t *bridge);
+static int lv2h_bridge_child(int argc, char **argv);
+static int lv2h_bridge_write_uris(lv2h_t *host);
+static int lv2h_bridge_dup_high(int fd);
+static int lv2h_bridge_wait(lv2h_bridge_t *bridge, uint32_t seq);
+static int lv2h_bridge_restart(lv2h_bridge_t *bridge, int has_exited);
+static int lv2h_bridge_stop(lv2h_bridge_t *bridge);
+static void lv2h_futex_wait(uint32_t *addr, uint32_t val, struct timespec *timeout);
+static void lv2h_futex_wake(uint32_t *addr);
+
+int lv2h_inst_new_bridged(lv2h_plug_t *plug, long timeout_us, lv2h_inst_t **out_inst) {
+    lv2h_inst_t *inst;
+
+    // The host side has ports but no lilv instance. The plugin itself
+    // only ever lives in the child.
+    if (lv2h_inst_init(plug, NULL, &inst) != LV2H_OK) {
+        return LV2H_ERR;
+    }
+    if (lv2h_bridge_new(inst, timeout_us) != LV2H_OK) {
+        lv2h_inst_free(inst);
+        return LV2H_ERR;
+    }
+
+    *out_inst = inst;
+    return LV2H_OK;
+}
+
+int lv2h_inst_get_bridge_stats(lv2h_inst_t *inst, unsigned long *out_timeouts, unsigned long *out_restarts) {
+    if (!inst->bridge) {
+        LV2H_RETURN_ERR(inst->plug->host, "lv2h_inst_get_bridge_stats: instance is not bridged\n%s", "");
+    }
+    if (out_timeouts) *out_timeouts = __atomic_load_n(&inst->bridge->timeout_count, __ATOMIC_RELAXED);
+    if (out_restarts) *out_restarts = __atomic_load_n(&inst->bridge->restart_count, __ATOMIC_RELAXED);
+    return LV2H_OK;
+}
+
+int lv2h_bridge_main(int argc, char **argv) {
+    // Returns unless this process was spawned as a bridge helper, in which
+    // case it runs the plugin and exits
+    if (argc < 2 || strcmp(argv[1], LV2H_BRIDGE_ARG) != 0) {
+        return LV2H_OK;
+    }
+    exit(lv2h_bridge_child(argc, argv) == LV2H_OK ? 0 : 1);
+}
+
+int lv2h_bridge_run(lv2h_inst_t *inst, int frame_count) {
+    lv2h_bridge_t *bridge;
+    lv2h_bridge_shm_t *shm;
+    lv2h_port_t *port;
+    LV2_Atom_Sequence *seq, *dst;
+    uint32_t req;
+    uint32_t size;
+    uint32_t p;
+
+    // Runs on the audio thread. Any failure means the instance sits out
+    // this block and the caller outputs silence.
+    bridge = inst->bridge;
+    shm = bridge->shm;
+    if (__atomic_load_n(&bridge->is_down, __ATOMIC_ACQUIRE)) {
+        return LV2H_ERR;
+    }
+    req = shm->req;
+    if (__atomic_load_n(&shm->ack, __ATOMIC_ACQUIRE) != req) {
+        // Still busy with a block that timed out
+        bridge->miss_count += 1;
+        return LV2H_ERR;
+    }
+
+    // The child is idle, so its slots can be filled. The graph only ever
+    // sees the host side buffers, which a late child cannot touch.
+    for (p = 0; p < bridge->audio_in_count; ++p) {
+        port = bridge->audio_in_array[p];
+        memcpy(bridge->base + bridge->port_offset_array[port->port_index], port->reader_block_mixed, sizeof(float) * frame_count);
+    }
+    for (p = 0; p < bridge->control_in_count; ++p) {
+        port = bridge->control_in_array[p];
+        *(float*)(bridge->base + bridge->port_offset_array[port->port_index]) = port->control_val;
+    }
+    for (p = 0; p < inst->atom_in_count; ++p) {
+        port = inst->atom_in_array[p];
+        seq = (LV2_Atom_Sequence*)lv2_evbuf_get_buffer(port->atom_input);
+        dst = (LV2_Atom_Sequence*)(bridge->base + bridge->port_offset_array[port->port_index]);
+        size = sizeof(LV2_Atom) + seq->atom.size;
+        if (size <= LV2H_BRIDGE_ATOM_SIZE) {
+            memcpy(dst, seq, size);
+        } else {
+            // More events than the slot holds, drop them all
+            dst->atom = seq->atom;
+            dst->body = seq->body;
+            dst->atom.size = sizeof(LV2_Atom_Sequence_Body);
+        }
+    }
+
+    shm->frame_count = frame_count;
+    __atomic_store_n(&shm->req, req + 1, __ATOMIC_RELEASE);
+    lv2h_futex_wake(&shm->req);
+
+    if (lv2h_bridge_wait(bridge, req + 1) != LV2H_OK) {
+        bridge->miss_count += 1;
+        __sync_fetch_and_add(&bridge->timeout_count, 1);
+        return LV2H_ERR;
+    }
+
+    // Outputs are only taken from a block the child finished
+    for (p = 0; p < bridge->audio_out_count; ++p) {
+        port = bridge->audio_out_array[p];
+        memcpy(port->writer_block, bridge->base + bridge->port_offset_array[port->port_index], sizeof(float) * frame_count);
+    }
+    for (p = 0; p < bridge->control_out_count; ++p) {
+        port = bridge->control_out_array[p];
+        port->control_val = *(float*)(bridge->base + bridge->port_offset_array[port->port_index]);
+    }
+    bridge->miss_count = 0;
+    return LV2H_OK;
+}
+
+int lv2h_bridge_check(lv2h_t *host) {
+    lv2h_bridge_t *bridge;
+    int status;
+    int has_exited;
+
+    // Runs on the control thread. Restart children that died or stopped
+    // answering; the rest of the graph keeps playing meanwhile.
+    LL_FOREACH(host->bridge_list, bridge) {
+        has_exited = bridge->pid > 0 && waitpid(bridge->pid, &status, WNOHANG) == bridge->pid;
+        if (has_exited || __atomic_load_n(&bridge->miss_count, __ATOMIC_RELAXED) >= bridge->stall_blocks) {
+            lv2h_bridge_restart(bridge, has_exited);
+        }
+    }
+    return LV2H_OK;
+}
+
+int lv2h_bridge_free(lv2h_inst_t *inst) {
+    lv2h_bridge_t *bridge;
+
+    // The caller has already synced with the audio thread
+    if (!(bridge = inst->bridge)) {
+        return LV2H_OK;
+    }
+    lv2h_bridge_stop(bridge);
+    LL_DELETE(inst->plug->host->bridge_list, bridge);
+    munmap(bridge->shm, bridge->map_size);
+    close(bridge->shm_fd);
+    free(bridge->port_offset_array);
+    free(bridge->audio_in_array);
+    free(bridge->audio_out_array);
+    free(bridge->control_in_array);
+    free(bridge->control_out_array);
+    free(bridge);
+    inst->bridge = NULL;
+    return LV2H_OK;
+}
+
+static int lv2h_bridge_new(lv2h_inst_t *inst, long timeout_us) {
+    lv2h_t *host;
+    lv2h_plug_t *plug;
+    lv2h_bridge_t *bridge;
+    lv2h_port_t *port;
+    uint64_t *offset_array;
+    size_t offset, size;
+    uint32_t p;
+
+    plug = inst->plug;
+    host = plug->host;
+    bridge = calloc(1, sizeof(lv2h_bridge_t));
+    bridge->inst = inst;
+    bridge->timeout_ns = timeout_us > 0 ? timeout_us * 1000L : ((long)host->block_size * 1000000000L / host->sample_rate) / 2;
+    bridge->stall_blocks = ((long)LV2H_BRIDGE_STALL_MS * host->sample_rate) / (1000L * host->block_size) + 1;
+    bridge->port_offset_array = calloc(plug->port_count, sizeof(size_t));
+    bridge->audio_in_array = calloc(plug->port_count + 1, sizeof(lv2h_port_t*));
+    bridge->audio_out_array = calloc(plug->port_count + 1, sizeof(lv2h_port_t*));
+    bridge->control_in_array = calloc(inst->control_count + 1, sizeof(lv2h_port_t*));
+    bridge->control_out_array = calloc(inst->control_count + 1, sizeof(lv2h_port_t*));
+
+    // Lay out one slot per port after the handshake header and the offset
+    // table the helper reads. Offset 0 means the port is left unconnected.
+    offset = sizeof(lv2h_bridge_shm_t) + plug->port_count * sizeof(uint64_t);
+    for (p = 0; p < plug->port_count; ++p) {
+        port = inst->port_array + p;
+        if (port->reader_block_mixed || port->writer_block) {
+            size = host->block_size * sizeof(float);
+        } else if (port->is_control) {
+            size = sizeof(float);
+        } else if (port->atom_input || port->atom_output) {
+            size = LV2H_BRIDGE_ATOM_SIZE;
+        } else {
+            continue;
+        }
+        offset = (offset + LV2H_BRIDGE_ALIGN - 1) & ~(size_t)(LV2H_BRIDGE_ALIGN - 1);
+        bridge->port_offset_array[p] = offset;
+        offset += size;
+    }
+    bridge->map_size = offset;
+
+    // Backed by a memfd so the helper can map it after exec
+    bridge->shm = MAP_FAILED;
+    if ((bridge->shm_fd = memfd_create("lv2h-bridge", MFD_CLOEXEC)) >= 0 && ftruncate(bridge->shm_fd, (off_t)bridge->map_size) == 0) {
+        bridge->shm = mmap(NULL, bridge->map_size, PROT_READ | PROT_WRITE, MAP_SHARED, bridge->shm_fd, 0);
+    }
+    if (bridge->shm == MAP_FAILED) {
+        if (bridge->shm_fd >= 0) close(bridge->shm_fd);
+        free(bridge->port_offset_array);
+        free(bridge->audio_in_array);
+        free(bridge->audio_out_array);
+        free(bridge->control_in_array);
+        free(bridge->control_out_array);
+        free(bridge);
+        LV2H_RETURN_ERR(host, "lv2h_inst_new_bridged: shared map: %s\n", strerror(errno));
+    }
+    bridge->base = (uint8_t*)bridge->shm;
+    bridge->shm->port_count = plug->port_count;
+    offset_array = (uint64_t*)(bridge->base + sizeof(lv2h_bridge_shm_t));
+    for (p = 0; p < plug->port_count; ++p) {
+        offset_array[p] = bridge->port_offset_array[p];
+    }
+
+    // Audio stays in the arena and is copied to and from the map around a
+    // completed handshake. A child still busy with a timed out block then
+    // never races the graph on the buffers it reads and writes.
+    for (p = 0; p < plug->port_count; ++p) {
+        port = inst->port_array + p;
+        if (port->reader_block_mixed) {
+            bridge->audio_in_array[bridge->audio_in_count++] = port;
+        } else if (port->writer_block) {
+            bridge->audio_out_array[bridge->audio_out_count++] = port;
+        } else if (port->is_control) {
+            *(float*)(bridge->base + bridge->port_offset_array[p]) = port->control_val;
+            if (lilv_port_is_a(plug->lilv_plugin, port->lilv_port, host->lv2_core_InputPort)) {
+                bridge->control_in_array[bridge->control_in_count++] = port;
+            } else {
+                bridge->control_out_array[bridge->control_out_count++] = port;
+            }
+        }
+    }
+
+    // Attached before the spawn so lv2h_inst_free unmaps on failure. Down
+    // until the child exists.
+    bridge->is_down = 1;
+    LL_APPEND(host->bridge_list, bridge);
+    __atomic_store_n(&inst->bridge, bridge, __ATOMIC_RELEASE);
+    if (lv2h_bridge_spawn(bridge) != LV2H_OK) {
+        LV2H_RETURN_ERR(host, "lv2h_inst_new_bridged: spawn: %s\n", strerror(errno));
+    }
+    __atomic_store_n(&bridge->is_down, 0, __ATOMIC_RELEASE);
+    return LV2H_OK;
+}
+
+static int lv2h_bridge_spawn(lv2h_bridge_t *bridge) {
+    lv2h_t *host;
+    posix_spawn_file_actions_t actions;
+    char rate_str[16];
+    char size_str[24];
+    char *argv[6];
+    int shm_fd, uri_fd;
+    pid_t pid;
+    int rv;
+
+    host = bridge->inst->plug->host;
+    bridge->shm->quit = 0;
+    __atomic_store_n(&bridge->shm->ack, bridge->shm->req, __ATOMIC_RELEASE);
+    bridge->pid = -1;
+
+    // The host is multithreaded by now, so the helper is a fresh exec of
+    // this binary rather than a fork. It gets the map and the URI table as
+    // fds 3 and 4. Both sources sit above those so the dup2s cannot
+    // clobber one another.
+    shm_fd = lv2h_bridge_dup_high(bridge->shm_fd);
+    uri_fd = lv2h_bridge_write_uris(host);
+    if (shm_fd < 0 || uri_fd < 0) {
+        rv = errno;
+        if (shm_fd >= 0) close(shm_fd);
+        if (uri_fd >= 0) close(uri_fd);
+        errno = rv;
+        return LV2H_ERR;
+    }
+    snprintf(rate_str, sizeof(rate_str), "%u", host->sample_rate);
+    snprintf(size_str, sizeof(size_str), "%d", host->block_size);
+    argv[0] = "lv2h-bridge";
+    argv[1] = LV2H_BRIDGE_ARG;
+    argv[2] = rate_str;
+    argv[3] = size_str;
+    argv[4] = bridge->inst->plug->uri_str;
+    argv[5] = NULL;
+
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, shm_fd, LV2H_BRIDGE_SHM_FD);
+    posix_spawn_file_actions_adddup2(&actions, uri_fd, LV2H_BRIDGE_URI_FD);
+    rv = posix_spawn(&pid, "/proc/self/exe", &actions, NULL, argv, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    close(shm_fd);
+    close(uri_fd);
+    if (rv != 0) {
+        errno = rv;
+        return LV2H_ERR;
+    }
+    bridge->pid = pid;
+    return LV2H_OK;
+}
+
+static int lv2h_bridge_child(int argc, char **argv) {
+    lv2h_t *host;
+    lv2h_plug_t *plug;
+    lv2h_bridge_shm_t *shm;
+    LilvInstance *lilv_inst;
+    const LilvPort *lilv_port;
+    LV2_Atom_Sequence *seq;
+    uint64_t *offset_array;
+    uint8_t *base;
+    uint8_t *is_atom_out;
+    struct stat st;
+    FILE *fp;
+    char *line;
+    size_t line_size;
+    ssize_t len;
+    LV2_URID urid;
+    uint32_t last, req;
+    uint32_t p;
+
+    // Helper process, started by lv2h_bridge_spawn. Dies with the host.
+    prctl(PR_SET_PDEATHSIG, SIGKILL);
+    if (argc < 5) {
+        return LV2H_ERR;
+    }
+    if (fstat(LV2H_BRIDGE_SHM_FD, &st) != 0
+        || (shm = mmap(NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, LV2H_BRIDGE_SHM_FD, 0)) == MAP_FAILED
+    ) {
+        return LV2H_ERR;
+    }
+    base = (uint8_t*)shm;
+    offset_array = (uint64_t*)(base + sizeof(lv2h_bridge_shm_t));
+
+    if (lv2h_new((uint32_t)strtoul(argv[2], NULL, 10), (size_t)strtoul(argv[3], NULL, 10), 0, &host) != LV2H_OK) {
+        return LV2H_ERR;
+    }
+
+    // Map the host's URIs in the host's order so URIDs in events and
+    // options agree on both sides
+    if (!(fp = fdopen(LV2H_BRIDGE_URI_FD, "r"))) {
+        return LV2H_ERR;
+    }
+    line = NULL;
+    line_size = 0;
+    urid = 0;
+    while ((len = getline(&line, &line_size, fp)) > 0) {
+        if (line[len - 1] == '\n') line[len - 1] = '\0';
+        if (host->urid_map.map(host->urid_map.handle, line) != ++urid) {
+            fprintf(stderr, "lv2h-bridge: URI map out of step at %s\n", line);
+            return LV2H_ERR;
+        }
+    }
+    free(line);
+    fclose(fp);
+
+    if (lv2h_plug_new(host, argv[4], &plug) != LV2H_OK || plug->port_count != shm->port_count) {
+        fprintf(stderr, "lv2h-bridge: %s", host->errstr);
+        return LV2H_ERR;
+    }
+    if (!(lilv_inst = lilv_plugin_instantiate(plug->lilv_plugin, (float)host->sample_rate, host->features))) {
+        return LV2H_ERR;
+    }
+    is_atom_out = calloc(plug->port_count + 1, sizeof(uint8_t));
+    for (p = 0; p < plug->port_count; ++p) {
+        if (!offset_array[p]) continue;
+        lilv_instance_connect_port(lilv_inst, p, base + offset_array[p]);
+        lilv_port = lilv_plugin_get_port_by_index(plug->lilv_plugin, p);
+        is_atom_out[p] = lilv_port_is_a(plug->lilv_plugin, lilv_port, host->lv2_atom_AtomPort)
+            && lilv_port_is_a(plug->lilv_plugin, lilv_port, host->lv2_core_OutputPort);
+    }
+    lilv_instance_activate(lilv_inst);
+
+    last = __atomic_load_n(&shm->ack, __ATOMIC_ACQUIRE);
+    for (;;) {
+        while ((req = __atomic_load_n(&shm->req, __ATOMIC_ACQUIRE)) == last) {
+            lv2h_futex_wait(&shm->req, last, NULL);
+        }
+        last = req;
+        if (__atomic_load_n(&shm->quit, __ATOMIC_ACQUIRE)) {
+            break;
+        }
+        for (p = 0; p < plug->port_count; ++p) {
+            if (is_atom_out[p]) {
+                // Output sequences start each run at full capacity
+                seq = (LV2_Atom_Sequence*)(base + offset_array[p]);
+                seq->atom.size = LV2H_BRIDGE_ATOM_SIZE - sizeof(LV2_Atom);
+            }
+        }
+        lilv_instance_run(lilv_inst, shm->frame_count);
+        __atomic_store_n(&shm->ack, last, __ATOMIC_RELEASE);
+        lv2h_futex_wake(&shm->ack);
+    }
+
+    lilv_instance_deactivate(lilv_inst);
+    lilv_instance_free(lilv_inst);
+    free(is_atom_out);
+    lv2h_free(host);
+    return LV2H_OK;
+}
+
+static int lv2h_bridge_write_uris(lv2h_t *host) {
+    size_t i;
+    int fd, high_fd;
+
+    // One URI per line in URID order, rewound for the helper to read
+    if ((fd = memfd_create("lv2h-uris", MFD_CLOEXEC)) < 0) {
+        return -1;
+    }
+    for (i = 0; i < host->lv2_uris_size; ++i) {
+        if (dprintf(fd, "%s\n", host->lv2_uris[i]) < 0) {
+            close(fd);
+            return -1;
+        }
+    }
+    lseek(fd, 0, SEEK_SET);
+    high_fd = lv2h_bridge_dup_high(fd);
+    close(fd);
+    return high_fd;
+}
+
+static int lv2h_bridge_dup_high(int fd) {
+    return fcntl(fd, F_DUPFD_CLOEXEC, LV2H_BRIDGE_URI_FD + 1);
+}
+
+static int lv2h_bridge_wait(lv2h_bridge_t *bridge, uint32_t seq) {
+    lv2h_bridge_shm_t *shm;
+    struct timespec ts;
+    long deadline_ns, remain_ns;
+    uint32_t ack;
+    int i;
+
+    // Spin briefly since most plugins answer within microseconds, then
+    // sleep on the futex until the deadline
+    shm = bridge->shm;
+    for (i = 0; i < LV2H_BRIDGE_SPIN; ++i) {
+        if (__atomic_load_n(&shm->ack, __ATOMIC_ACQUIRE) == seq) return LV2H_OK;
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#endif
+    }
+    deadline_ns = lv2h_trace_now_ns() + bridge->timeout_ns;
+    for (;;) {
+        if ((ack = __atomic_load_n(&shm->ack, __ATOMIC_ACQUIRE)) == seq) return LV2H_OK;
+        if ((remain_ns = deadline_ns - lv2h_trace_now_ns()) <= 0) return LV2H_ERR;
+        ts.tv_sec = remain_ns / 1000000000L;
+        ts.tv_nsec = remain_ns % 1000000000L;
+        lv2h_futex_wait(&shm->ack, ack, &ts);
+    }
+}
+
+static int lv2h_bridge_restart(lv2h_bridge_t *bridge, int has_exited) {
+    lv2h_t *host;
+
+    // Take the bridge out of the audio path before touching the handshake
+    host = bridge->inst->plug->host;
+    __atomic_store_n(&bridge->is_down, 1, __ATOMIC_RELEASE);
+    lv2h_graph_compile(host);
+    lv2h_graph_sync(host);
+
+    if (!has_exited && bridge->pid > 0) {
+        kill(bridge->pid, SIGKILL);
+        waitpid(bridge->pid, NULL, 0);
+    }
+    bridge->miss_count = 0;
+    __sync_fetch_and_add(&bridge->restart_count, 1);
+    LV2H_LOG(host, LV2H_LOG_WARN, "bridge: restarting %s\n", bridge->inst->plug->uri_str);
+
+    // Plugin state beyond port values starts over in the new child
+    if (lv2h_bridge_spawn(bridge) != LV2H_OK) {
+        LV2H_LOG(host, LV2H_LOG_ERROR, "bridge: could not restart %s: %s\n", bridge->inst->plug->uri_str, strerror(errno));
+        return LV2H_ERR;
+    }
+    __atomic_store_n(&bridge->is_down, 0, __ATOMIC_RELEASE);
+    return LV2H_OK;
+}
+
+static int lv2h_bridge_stop(lv2h_bridge_t *bridge) {
+    struct timespec ts;
+    int i;
+
+    if (bridge->pid <= 0) {
+        return LV2H_OK;
+    }
+
+    // Ask nicely, then kill
+    __atomic_store_n(&bridge->shm->quit, 1, __ATOMIC_RELEASE);
+    __atomic_add_fetch(&bridge->shm->req, 1, __ATOMIC_RELEASE);
+    lv2h_futex_wake(&bridge->shm->req);
+    ts.tv_sec = 0;
+    ts.tv_nsec = 1000000L;
+    for (i = 0; i < LV2H_BRIDGE_QUIT_MS; ++i) {
+        if (waitpid(bridge->pid, NULL, WNOHANG) == bridge->pid) {
+            bridge->pid = -1;
+            return LV2H_OK;
+        }
+        nanosleep(&ts, NULL);
+    }
+    kill(bridge->pid, SIGKILL);
+    waitpid(bridge->pid, NULL, 0);
+    bridge->pid = -1;
+    return LV2H_OK;
+}
+
+static void lv2h_futex_wait(uint32_t *addr, uint32_t val, struct timespec *timeout) {
+    // Shared, not private, since the waiter and waker are different processes
+    syscall(SYS_futex, addr, FUTEX_WAIT, val, timeout, NULL, 0);
+}
+
+static void lv2h_futex_wake(uint32_t *addr) {
+    syscall(SYS_futex, addr, FUTEX_WAKE, 1, NULL, NULL, 0);
+}
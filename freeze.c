@@ -0,0 +1,211 @@
+#include "lv2h.h"
+#include <errno.h>
+#include <sys/mman.h>
+
+static int lv2h_freeze_new(lv2h_inst_t *inst, long frame_count, lv2h_freeze_t **out_freeze);
+static int lv2h_freeze_render(lv2h_t *host, lv2h_sched_t *sched, lv2h_freeze_t *freeze, lv2h_freeze_callback_fn callback, void *udata);
+static void lv2h_freeze_destroy(lv2h_freeze_t *freeze);
+
+// The subgraph this thread is rendering, if any. Only that thread may
+// touch its instances until the render ends.
+static __thread lv2h_sched_t *lv2h_freeze_render_sched = NULL;
+
+int lv2h_inst_freeze(lv2h_inst_t *inst, long len_ms, lv2h_freeze_callback_fn callback, void *udata) {
+    lv2h_t *host;
+    lv2h_freeze_t *freeze;
+    lv2h_sched_t *sched;
+    lv2h_inst_t *sub_inst;
+    long frame_count;
+    size_t i;
+    int rv;
+
+    host = inst->plug->host;
+    if (inst->is_frozen) {
+        LV2H_RETURN_ERR(host, "lv2h_inst_freeze: instance already frozen\n%s", "");
+    }
+    if (!inst->lilv_inst) {
+        LV2H_RETURN_ERR(host, "lv2h_inst_freeze: cannot freeze a host instance\n%s", "");
+    }
+    if ((frame_count = (len_ms * (long)host->sample_rate) / 1000L) < 1) {
+        LV2H_RETURN_ERR(host, "lv2h_inst_freeze: invalid length %ld ms\n", len_ms);
+    }
+    if (lv2h_freeze_new(inst, frame_count, &freeze) != LV2H_OK) {
+        return LV2H_ERR;
+    }
+
+    // Take the subgraph out of the live schedule. Readers of the instance
+    // hear silence until the rendered buffer is published.
+    inst->is_frozen = 1;
+    lv2h_graph_compile(host);
+    lv2h_graph_sync(host);
+
+    pthread_mutex_lock(&host->graph_mutex);
+    sched = lv2h_graph_build(host, inst);
+    pthread_mutex_unlock(&host->graph_mutex);
+
+    // Anything upstream that the live graph still reaches by another path
+    // cannot be run offline at the same time. The root itself stays in the
+    // live schedule as a frozen item and is not run there.
+    rv = LV2H_OK;
+    for (i = 0; i < sched->item_count; ++i) {
+        sub_inst = sched->item_array[i].inst;
+        if (sub_inst != inst && sub_inst->is_reachable) {
+            rv = LV2H_ERR;
+            break;
+        }
+        if (sub_inst->lilv_inst && !sub_inst->is_active) {
+            lilv_instance_activate(sub_inst->lilv_inst);
+            sub_inst->is_active = 1;
+        }
+    }
+
+    if (rv == LV2H_OK) {
+        // Messages sent from the callback go straight to the subgraph.
+        // Anything still queued for it is dropped, and the compile and sync
+        // wait out a drain that may already be in progress.
+        for (i = 0; i < sched->item_count; ++i) {
+            __atomic_store_n(&sched->item_array[i].inst->is_rendering, 1, __ATOMIC_RELEASE);
+            lv2h_msg_purge_inst(sched->item_array[i].inst);
+        }
+        lv2h_graph_compile(host);
+        lv2h_graph_sync(host);
+        rv = lv2h_freeze_render(host, sched, freeze, callback, udata);
+        for (i = 0; i < sched->item_count; ++i) __atomic_store_n(&sched->item_array[i].inst->is_rendering, 0, __ATOMIC_RELEASE);
+    } else {
+        snprintf(host->errstr, sizeof(host->errstr), "lv2h_inst_freeze: subgraph is shared with the live graph\n");
+    }
+    lv2h_sched_free(sched);
+
+    if (rv != LV2H_OK) {
+        inst->is_frozen = 0;
+        lv2h_graph_compile(host);
+        lv2h_freeze_destroy(freeze);
+        return LV2H_ERR;
+    }
+
+    // Swap the playback node in. The upstream instances are now unreachable
+    // and are deactivated if pruning is enabled.
+    __atomic_store_n(&inst->freeze, freeze, __ATOMIC_RELEASE);
+    lv2h_graph_compile(host);
+    return LV2H_OK;
+}
+
+int lv2h_inst_unfreeze(lv2h_inst_t *inst) {
+    if (!inst->is_frozen) {
+        return LV2H_OK;
+    }
+    inst->is_frozen = 0;
+    lv2h_graph_compile(inst->plug->host);
+    lv2h_graph_sync(inst->plug->host);
+    return lv2h_freeze_free(inst);
+}
+
+int lv2h_freeze_free(lv2h_inst_t *inst) {
+    if (inst->freeze) {
+        lv2h_freeze_destroy(inst->freeze);
+        inst->freeze = NULL;
+    }
+    return LV2H_OK;
+}
+
+int lv2h_freeze_owns(lv2h_inst_t *inst) {
+    size_t i;
+    if (!lv2h_freeze_render_sched) {
+        return 0;
+    }
+    for (i = 0; i < lv2h_freeze_render_sched->item_count; ++i) {
+        if (lv2h_freeze_render_sched->item_array[i].inst == inst) return 1;
+    }
+    return 0;
+}
+
+int lv2h_freeze_play(lv2h_inst_t *inst, int frame_count) {
+    lv2h_freeze_t *freeze;
+    lv2h_port_t *port;
+    float *src;
+    long position;
+    long n;
+    int offset;
+    uint32_t p;
+
+    freeze = __atomic_load_n(&inst->freeze, __ATOMIC_ACQUIRE);
+
+    // Loop the rendered range, one memcpy per port per wrap
+    position = freeze->position;
+    for (p = 0; p < freeze->port_count; ++p) {
+        port = freeze->port_array[p];
+        src = freeze->buffer + (size_t)p * freeze->frame_count;
+        position = freeze->position;
+        for (offset = 0; offset < frame_count; offset += n) {
+            n = freeze->frame_count - position;
+            if (n > frame_count - offset) n = frame_count - offset;
+            memcpy(port->writer_block + offset, src + position, sizeof(float) * n);
+            position = (position + n) % freeze->frame_count;
+        }
+        port->is_silent = 0;
+    }
+    freeze->position = position;
+    return LV2H_OK;
+}
+
+static int lv2h_freeze_new(lv2h_inst_t *inst, long frame_count, lv2h_freeze_t **out_freeze) {
+    lv2h_t *host;
+    lv2h_freeze_t *freeze;
+
+    host = inst->plug->host;
+    if (!(freeze = calloc(1, sizeof(lv2h_freeze_t)))) {
+        LV2H_RETURN_ERR(host, "lv2h_inst_freeze: calloc failed\n%s", "");
+    }
+    if (inst->audio_out_count < 1) {
+        lv2h_freeze_destroy(freeze);
+        LV2H_RETURN_ERR(host, "lv2h_inst_freeze: instance has no audio outputs\n%s", "");
+    }
+    freeze->port_count = inst->audio_out_count;
+    freeze->port_array = calloc(freeze->port_count, sizeof(lv2h_port_t*));
+    memcpy(freeze->port_array, inst->audio_out_array, freeze->port_count * sizeof(lv2h_port_t*));
+
+    // Anonymous mapping so long renders do not fragment the heap
+    freeze->frame_count = frame_count;
+    freeze->map_size = (size_t)frame_count * freeze->port_count * sizeof(float);
+    freeze->buffer = mmap(NULL, freeze->map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (freeze->buffer == MAP_FAILED) {
+        freeze->buffer = NULL;
+        lv2h_freeze_destroy(freeze);
+        LV2H_RETURN_ERR(host, "lv2h_inst_freeze: mmap: %s\n", strerror(errno));
+    }
+
+    *out_freeze = freeze;
+    return LV2H_OK;
+}
+
+static int lv2h_freeze_render(lv2h_t *host, lv2h_sched_t *sched, lv2h_freeze_t *freeze, lv2h_freeze_callback_fn callback, void *udata) {
+    long frame;
+    int frame_count;
+    uint32_t p;
+
+    // Runs on the calling thread as fast as the plugins allow
+    lv2h_freeze_render_sched = sched;
+    for (frame = 0; frame < freeze->frame_count; frame += frame_count) {
+        frame_count = host->block_size;
+        if (frame_count > freeze->frame_count - frame) {
+            frame_count = (int)(freeze->frame_count - frame);
+        }
+        if (callback && (callback)(sched->root, udata, frame) != LV2H_OK) {
+            lv2h_freeze_render_sched = NULL;
+            LV2H_RETURN_ERR(host, "lv2h_inst_freeze: callback failed at frame %ld\n", frame);
+        }
+        // Whole blocks even at the end, the tail is just not kept
+        lv2h_run_sched(host, sched, host->block_size);
+        for (p = 0; p < freeze->port_count; ++p) {
+            memcpy(freeze->buffer + (size_t)p * freeze->frame_count + frame, freeze->port_array[p]->writer_block, sizeof(float) * frame_count);
+        }
+    }
+    lv2h_freeze_render_sched = NULL;
+    return LV2H_OK;
+}
+
+static void lv2h_freeze_destroy(lv2h_freeze_t *freeze) {
+    if (freeze->buffer) munmap(freeze->buffer, freeze->map_size);
+    if (freeze->port_array) free(freeze->port_array);
+    free(freeze);
+}
@@ -0,0 +1,679 @@
+#include "lv2h.h"
+
+#define LV2H_GRAPH_SYNC_SLEEP_NS 1000000L
+
+static int lv2h_graph_is_frozen(lv2h_sched_t *sched, lv2h_inst_t *inst);
+static int lv2h_graph_visit(lv2h_t *host, lv2h_sched_t *sched, size_t *item_cap, lv2h_inst_t *inst);
+static int lv2h_graph_group_plugs(lv2h_sched_t *sched);
+static int lv2h_graph_add_edge(lv2h_sched_t *sched, size_t *edge_cap, lv2h_port_t *reader_port, lv2h_port_t *writer_port, float *writer_block, int is_first);
+static int lv2h_run_edges(lv2h_sched_t *sched, lv2h_sched_item_t *item, int frame_count);
+static int lv2h_inst_should_sleep(lv2h_inst_t *inst, int inputs_silent);
+static int lv2h_inst_update_silence(lv2h_inst_t *inst, int inputs_silent, int frame_count);
+static int lv2h_inst_skip_run(lv2h_inst_t *inst, int frame_count);
+static int lv2h_block_is_silent(float *block, int frame_count);
+static int lv2h_graph_add_delay_port(lv2h_sched_t *sched, size_t *delay_cap, lv2h_port_t *port);
+static long lv2h_graph_input_latency(lv2h_sched_t *sched, lv2h_inst_t *inst);
+static int lv2h_graph_reclaim(lv2h_t *host);
+static int lv2h_graph_update_activation(lv2h_t *host, int deactivate);
+
+int lv2h_graph_compile(lv2h_t *host) {
+    lv2h_sched_t *sched, *old_sched;
+    int prune_count;
+
+    pthread_mutex_lock(&host->graph_mutex);
+
+    sched = lv2h_graph_build(host, host->audio_inst);
+
+    // Instances joining the schedule must be active before it is published
+    prune_count = lv2h_graph_update_activation(host, 0);
+
+    old_sched = host->sched;
+    __atomic_store_n(&host->sched, sched, __ATOMIC_SEQ_CST);
+    if (old_sched) {
+        LL_PREPEND(host->sched_retired_list, old_sched);
+    }
+    lv2h_graph_reclaim(host);
+
+    pthread_mutex_unlock(&host->graph_mutex);
+
+    // Instances that left the schedule can be deactivated once the audio
+    // thread is done with the previous schedule
+    if (prune_count > 0 && host->prune_deactivate) {
+        lv2h_graph_sync(host);
+        pthread_mutex_lock(&host->graph_mutex);
+        lv2h_graph_update_activation(host, 1);
+        pthread_mutex_unlock(&host->graph_mutex);
+    }
+
+    return LV2H_OK;
+}
+
+lv2h_sched_t *lv2h_graph_build(lv2h_t *host, lv2h_inst_t *root) {
+    lv2h_sched_t *sched;
+    lv2h_sched_item_t *item;
+    lv2h_inst_t *inst;
+    lv2h_port_t *port;
+    lv2h_conn_t *conn;
+    size_t item_cap, edge_cap, delay_cap;
+    size_t i;
+    uint32_t p;
+    long in_latency;
+    int is_first;
+    int is_live;
+
+    sched = calloc(1, sizeof(lv2h_sched_t));
+    sched->root = root;
+    is_live = (root == host->audio_inst);
+    item_cap = edge_cap = delay_cap = 0;
+
+    // Depth-first from the root. Post-order puts every writer before its
+    // readers. A writer found on the current path closes a cycle, so that
+    // connection becomes a feedback edge with a one-block delay.
+    host->graph_gen += 1;
+    lv2h_graph_visit(host, sched, &item_cap, root);
+    if (host->group_plugs) {
+        lv2h_graph_group_plugs(sched);
+    }
+
+    for (i = 0; i < sched->item_count; ++i) {
+        item = sched->item_array + i;
+        inst = item->inst;
+        item->edge_start = sched->edge_count;
+        item->is_frozen = lv2h_graph_is_frozen(sched, inst);
+
+        // Writers come first, so their path latency is known. Shorter
+        // branches into this instance are delayed to match the longest.
+        // A frozen instance loops its render with no fixed relation to
+        // live input, so it counts as zero.
+        in_latency = item->is_frozen ? 0 : lv2h_graph_input_latency(sched, inst);
+        inst->path_latency = item->is_frozen ? 0 : in_latency + __atomic_load_n(&inst->latency_frames, __ATOMIC_ACQUIRE);
+
+        for (p = 0; !item->is_frozen && p < inst->audio_in_count; ++p) {
+            port = inst->audio_in_array[p];
+            if (!port->conn_list) {
+                // Silence inputs that lost their last writer
+                if (port->was_connected) {
+                    lv2h_graph_add_edge(sched, &edge_cap, port, NULL, NULL, 1);
+                }
+                continue;
+            }
+            is_first = 1;
+            LL_FOREACH(port->conn_list, conn) {
+                if (lv2h_graph_is_frozen(sched, conn->writer_port->inst) && !conn->writer_port->inst->freeze) {
+                    lv2h_graph_add_edge(sched, &edge_cap, port, NULL, NULL, is_first);
+                    lv2h_latency_line_get(sched, conn, 0, is_live);
+                } else if (conn->is_feedback) {
+                    if (!conn->writer_port->feedback_block) {
+                        conn->writer_port->feedback_block = calloc(host->block_size, sizeof(float));
+                    }
+                    lv2h_graph_add_delay_port(sched, &delay_cap, conn->writer_port);
+                    lv2h_graph_add_edge(sched, &edge_cap, port, conn->writer_port, conn->writer_port->feedback_block, is_first);
+                    lv2h_latency_line_get(sched, conn, 0, is_live);
+                } else {
+                    lv2h_graph_add_edge(sched, &edge_cap, port, conn->writer_port, conn->writer_port->writer_block, is_first);
+                    sched->edge_array[sched->edge_count - 1].latency_line = lv2h_latency_line_get(sched, conn, in_latency - conn->writer_port->inst->path_latency, is_live);
+                }
+                is_first = 0;
+            }
+        }
+        item->edge_count = sched->edge_count - item->edge_start;
+    }
+
+    if (is_live) {
+        __atomic_store_n(&host->output_latency_frames, root->path_latency, __ATOMIC_RELEASE);
+    }
+
+    return sched;
+}
+
+int lv2h_set_prune(lv2h_t *host, int deactivate) {
+    host->prune_deactivate = deactivate;
+    return lv2h_graph_compile(host);
+}
+
+int lv2h_set_group_plugs(lv2h_t *host, int enabled) {
+    host->group_plugs = enabled;
+    return lv2h_graph_compile(host);
+}
+
+int lv2h_graph_sync(lv2h_t *host) {
+    struct timespec ts;
+    ts.tv_sec = 0;
+    ts.tv_nsec = LV2H_GRAPH_SYNC_SLEEP_NS;
+    // Wait until the audio thread no longer uses a retired schedule
+    for (;;) {
+        pthread_mutex_lock(&host->graph_mutex);
+        lv2h_graph_reclaim(host);
+        if (!host->sched_retired_list) break;
+        pthread_mutex_unlock(&host->graph_mutex);
+        nanosleep(&ts, NULL);
+    }
+    pthread_mutex_unlock(&host->graph_mutex);
+    return LV2H_OK;
+}
+
+int lv2h_set_sleep(lv2h_t *host, int enabled, long default_tail_ms) {
+    host->sleep_enabled = enabled;
+    host->default_tail_frames = (default_tail_ms * host->sample_rate) / 1000L;
+    return LV2H_OK;
+}
+
+int lv2h_inst_set_tail(lv2h_inst_t *inst, long tail_ms) {
+    // A negative tail falls back to the host default
+    inst->tail_frames = tail_ms < 0 ? -1L : (tail_ms * inst->plug->host->sample_rate) / 1000L;
+    return LV2H_OK;
+}
+
+int lv2h_graph_free(lv2h_t *host) {
+    lv2h_sched_t *sched, *sched_tmp;
+    LL_FOREACH_SAFE(host->sched_retired_list, sched, sched_tmp) {
+        LL_DELETE(host->sched_retired_list, sched);
+        lv2h_sched_free(sched);
+    }
+    if (host->sched) {
+        lv2h_sched_free(host->sched);
+        host->sched = NULL;
+    }
+    return LV2H_OK;
+}
+
+int lv2h_run_plugin_insts(lv2h_t *host, int frame_count) {
+    lv2h_sched_t *sched;
+
+    lv2h_rtcheck_block_begin();
+
+    // Publish which schedule we are using so the control thread knows when
+    // a retired one can be freed
+    do {
+        sched = __atomic_load_n(&host->sched, __ATOMIC_ACQUIRE);
+        __atomic_store_n(&host->sched_in_use, sched, __ATOMIC_SEQ_CST);
+    } while (sched != __atomic_load_n(&host->sched, __ATOMIC_SEQ_CST));
+
+    // Drain inside the published window so lv2h_graph_sync also waits out
+    // any message for an instance being freed
+    lv2h_msg_drain(host);
+
+    if (sched) {
+        lv2h_run_sched(host, sched, frame_count);
+    }
+    lv2h_rec_tap(host, frame_count);
+
+    __atomic_store_n(&host->sched_in_use, NULL, __ATOMIC_RELEASE);
+    __sync_fetch_and_add(&host->audio_iter, 1);
+    lv2h_rtcheck_block_end();
+    return LV2H_OK;
+}
+
+int lv2h_run_sched(lv2h_t *host, lv2h_sched_t *sched, int frame_count) {
+    lv2h_sched_item_t *item;
+    lv2h_inst_t *inst;
+    lv2h_port_t *port;
+    uintmax_t audio_iter;
+    size_t i;
+    uint32_t p;
+    int inputs_silent;
+    long trace_ns;
+
+    audio_iter = host->audio_iter;
+
+    for (i = 0; i < sched->item_count; ++i) {
+        item = sched->item_array + i;
+        inst = item->inst;
+
+        if (item->is_frozen) {
+            lv2h_freeze_play(inst, frame_count);
+            continue;
+        }
+
+        inputs_silent = lv2h_run_edges(sched, item, frame_count);
+
+        // Host audio and capture instances have nothing to run. Bridged
+        // instances run in their child process.
+        if (!inst->lilv_inst && !inst->bridge) continue;
+
+        if (host->sleep_enabled && !__atomic_load_n(&inst->pending_preset, __ATOMIC_ACQUIRE) && lv2h_inst_should_sleep(inst, inputs_silent)) {
+            continue;
+        }
+
+        // Events and params were handed over lock-free at block start. The
+        // lock only keeps run away from a control thread state restore, and
+        // the audio thread never waits on it.
+        if (pthread_mutex_trylock(&inst->mutex) != 0) {
+            lv2h_inst_skip_run(inst, frame_count);
+            __sync_fetch_and_add(&host->lock_stats.run_skipped, 1);
+            continue;
+        }
+        inst->has_events = 0;
+
+        // Preset switches land on a block boundary. Taken under the lock,
+        // so ports and any restored state go live in the same run.
+        if (__atomic_load_n(&inst->pending_preset, __ATOMIC_ACQUIRE)) {
+            lv2h_preset_apply_ports(inst, __atomic_exchange_n(&inst->pending_preset, NULL, __ATOMIC_ACQ_REL));
+        }
+
+        trace_ns = LV2H_TRACE_BEGIN(host);
+        if (inst->bridge) {
+            if (lv2h_bridge_run(inst, frame_count) != LV2H_OK) {
+                LV2H_TRACE_END(host, inst->plug->trace_name, inst, trace_ns);
+                pthread_mutex_unlock(&inst->mutex);
+                lv2h_inst_skip_run(inst, frame_count);
+                continue;
+            }
+        } else {
+            lilv_instance_run(inst->lilv_inst, frame_count);
+        }
+        LV2H_TRACE_END(host, inst->plug->trace_name, inst, trace_ns);
+        if (inst->has_probe) {
+            lv2h_probe_run(host, inst);
+        }
+        if (inst->latency_port) {
+            lv2h_latency_update(inst);
+        }
+        for (p = 0; p < inst->atom_in_count; ++p) {
+            port = inst->atom_in_array[p];
+            if (lv2_evbuf_get_size(port->atom_input) > 0) {
+                LV2H_LOG(host, LV2H_LOG_DEBUG, "atom_input size was %u\n", lv2_evbuf_get_size(port->atom_input));
+                lv2_evbuf_reset(port->atom_input, 1);
+                port->atom_frame = 0;
+            }
+        }
+        pthread_mutex_unlock(&inst->mutex);
+
+        lv2h_inst_update_silence(inst, inputs_silent, frame_count);
+        inst->audio_iter = audio_iter;
+    }
+
+    // Feedback edges read this block's output during the next block
+    for (i = 0; i < sched->delay_port_count; ++i) {
+        port = sched->delay_port_array[i];
+        memcpy(port->feedback_block, port->writer_block, sizeof(float) * frame_count);
+    }
+
+    return LV2H_OK;
+}
+
+static int lv2h_run_edges(lv2h_sched_t *sched, lv2h_sched_item_t *item, int frame_count) {
+    lv2h_sched_edge_t *edge;
+    lv2h_port_t *reader_port;
+    float *reader_block;
+    float *writer_block;
+    size_t e;
+    int writer_silent;
+    int inputs_silent;
+    int f;
+
+    // Mix writers into reader ports, tracking silence so that silent
+    // writers cost nothing and silent readers are only cleared once
+    inputs_silent = 1;
+    for (e = item->edge_start; e < item->edge_start + item->edge_count; ++e) {
+        edge = sched->edge_array + e;
+        reader_port = edge->reader_port;
+        reader_block = reader_port->reader_block_mixed;
+        writer_silent = !edge->writer_port || edge->writer_port->is_silent;
+        writer_block = edge->writer_block;
+        if (edge->latency_line) {
+            // Compensation delay keeps playing out after the writer goes quiet
+            writer_silent = lv2h_latency_line_run(edge->latency_line, writer_silent ? NULL : writer_block, frame_count);
+            writer_block = edge->latency_line->out_block;
+        }
+        if (edge->is_first) {
+            if (writer_silent) {
+                if (!reader_port->is_silent) {
+                    memset(reader_block, 0, sizeof(float) * frame_count);
+                    reader_port->is_silent = 1;
+                }
+            } else {
+                memcpy(reader_block, writer_block, sizeof(float) * frame_count);
+                reader_port->is_silent = 0;
+            }
+        } else if (!writer_silent) {
+            if (reader_port->is_silent) {
+                memcpy(reader_block, writer_block, sizeof(float) * frame_count);
+            } else {
+                for (f = 0; f < frame_count; ++f) {
+                    reader_block[f] += writer_block[f];
+                }
+            }
+            reader_port->is_silent = 0;
+        }
+        if (!reader_port->is_silent) {
+            inputs_silent = 0;
+        }
+    }
+    return inputs_silent;
+}
+
+static int lv2h_inst_should_sleep(lv2h_inst_t *inst, int inputs_silent) {
+    lv2h_port_t *port;
+    long tail_frames;
+    uint32_t p;
+
+    if (!inputs_silent || inst->has_events || inst->wake) {
+        inst->wake = 0;
+        inst->silent_frames = 0;
+        inst->is_sleeping = 0;
+        return 0;
+    }
+    if (inst->is_sleeping) {
+        return 1;
+    }
+    tail_frames = inst->tail_frames >= 0 ? inst->tail_frames : inst->plug->host->default_tail_frames;
+    if (inst->silent_frames < tail_frames) {
+        return 0;
+    }
+
+    // Going to sleep. Zero outputs once so readers see exact silence.
+    for (p = 0; p < inst->audio_out_count; ++p) {
+        port = inst->audio_out_array[p];
+        memset(port->writer_block, 0, sizeof(float) * inst->plug->host->block_size);
+        port->is_silent = 1;
+    }
+    inst->is_sleeping = 1;
+    return 1;
+}
+
+static int lv2h_inst_update_silence(lv2h_inst_t *inst, int inputs_silent, int frame_count) {
+    lv2h_port_t *port;
+    uint32_t p;
+    int outputs_silent;
+
+    outputs_silent = 1;
+    for (p = 0; p < inst->audio_out_count; ++p) {
+        port = inst->audio_out_array[p];
+        port->is_silent = lv2h_block_is_silent(port->writer_block, frame_count);
+        outputs_silent &= port->is_silent;
+    }
+    if (inputs_silent && outputs_silent) {
+        inst->silent_frames += frame_count;
+    } else {
+        inst->silent_frames = 0;
+    }
+    return LV2H_OK;
+}
+
+static int lv2h_inst_skip_run(lv2h_inst_t *inst, int frame_count) {
+    lv2h_port_t *port;
+    uint32_t p;
+
+    // Readers get silence rather than a repeat of the last block. Pending
+    // events stay in the atom buffers for the next run.
+    for (p = 0; p < inst->audio_out_count; ++p) {
+        port = inst->audio_out_array[p];
+        if (!port->is_silent) {
+            memset(port->writer_block, 0, sizeof(float) * frame_count);
+            port->is_silent = 1;
+        }
+    }
+    return LV2H_OK;
+}
+
+static int lv2h_block_is_silent(float *block, int frame_count) {
+    int loud;
+    int f;
+    // Branchless count so the compiler can vectorize the loop
+    loud = 0;
+    for (f = 0; f < frame_count; ++f) {
+        loud += fabsf(block[f]) > LV2H_SILENCE_THRESHOLD;
+    }
+    return loud == 0;
+}
+
+static int lv2h_graph_visit(lv2h_t *host, lv2h_sched_t *sched, size_t *item_cap, lv2h_inst_t *inst) {
+    lv2h_inst_t *writer_inst;
+    lv2h_port_t *port;
+    lv2h_conn_t *conn;
+    uint32_t p;
+
+    inst->graph_gen = host->graph_gen;
+    inst->graph_on_path = 1;
+
+    // A frozen instance plays back its cached output, so its inputs are
+    // not needed
+    if (lv2h_graph_is_frozen(sched, inst)) {
+        goto lv2h_graph_visit_done;
+    }
+
+    for (p = 0; p < inst->audio_in_count; ++p) {
+        port = inst->audio_in_array[p];
+        LL_FOREACH(port->conn_list, conn) {
+            writer_inst = conn->writer_port->inst;
+            conn->is_feedback = 0;
+            if (writer_inst->graph_gen != host->graph_gen) {
+                lv2h_graph_visit(host, sched, item_cap, writer_inst);
+            } else if (writer_inst->graph_on_path) {
+                conn->is_feedback = 1;
+            }
+        }
+    }
+
+lv2h_graph_visit_done:
+    inst->graph_on_path = 0;
+
+    // Still rendering, so leave it out until its buffer is published
+    if (lv2h_graph_is_frozen(sched, inst) && !inst->freeze) {
+        return LV2H_OK;
+    }
+
+    if (sched->item_count >= *item_cap) {
+        *item_cap = *item_cap ? *item_cap * 2 : 16;
+        sched->item_array = realloc(sched->item_array, *item_cap * sizeof(lv2h_sched_item_t));
+    }
+    sched->item_array[sched->item_count].inst = inst;
+    sched->item_count += 1;
+    return LV2H_OK;
+}
+
+static int lv2h_graph_group_plugs(lv2h_sched_t *sched) {
+    lv2h_sched_item_t *item_array;
+    lv2h_inst_t *inst, *writer_inst;
+    lv2h_port_t *port;
+    lv2h_conn_t *conn;
+    lv2h_plug_t *last_plug;
+    size_t *dep_array, *succ_start, *succ_fill, *succ_array, *indeg, *ready_array;
+    size_t dep_count, dep_cap, ready_count;
+    size_t n, i, j, r, pick;
+    uint32_t p;
+
+    // Kahn's algorithm over the post-order from lv2h_graph_visit. Among
+    // ready instances, one of the plugin that just ran wins, so copies of
+    // a plugin run back to back and keep its code hot in the i-cache.
+    // Otherwise the earliest in the original order goes next.
+    n = sched->item_count;
+    if (n < 3) {
+        return LV2H_OK;
+    }
+    for (i = 0; i < n; ++i) {
+        sched->item_array[i].inst->graph_index = i;
+    }
+
+    // Writer and reader index pairs. Feedback edges and the inputs of
+    // frozen instances impose no order.
+    dep_array = NULL;
+    dep_count = dep_cap = 0;
+    for (i = 0; i < n; ++i) {
+        inst = sched->item_array[i].inst;
+        if (lv2h_graph_is_frozen(sched, inst)) continue;
+        for (p = 0; p < inst->audio_in_count; ++p) {
+            port = inst->audio_in_array[p];
+            LL_FOREACH(port->conn_list, conn) {
+                writer_inst = conn->writer_port->inst;
+                if (conn->is_feedback) continue;
+                if (writer_inst->graph_index >= n || sched->item_array[writer_inst->graph_index].inst != writer_inst) continue;
+                if (dep_count >= dep_cap) {
+                    dep_cap = dep_cap ? dep_cap * 2 : 32;
+                    dep_array = realloc(dep_array, dep_cap * 2 * sizeof(size_t));
+                }
+                dep_array[dep_count * 2] = writer_inst->graph_index;
+                dep_array[dep_count * 2 + 1] = i;
+                dep_count += 1;
+            }
+        }
+    }
+
+    // Successor lists in one array, indexed by writer
+    succ_start = calloc(n + 1, sizeof(size_t));
+    succ_fill = calloc(n, sizeof(size_t));
+    succ_array = calloc(dep_count + 1, sizeof(size_t));
+    indeg = calloc(n, sizeof(size_t));
+    for (j = 0; j < dep_count; ++j) {
+        succ_start[dep_array[j * 2] + 1] += 1;
+        indeg[dep_array[j * 2 + 1]] += 1;
+    }
+    for (i = 0; i < n; ++i) {
+        succ_start[i + 1] += succ_start[i];
+    }
+    for (j = 0; j < dep_count; ++j) {
+        i = dep_array[j * 2];
+        succ_array[succ_start[i] + succ_fill[i]++] = dep_array[j * 2 + 1];
+    }
+
+    ready_array = calloc(n, sizeof(size_t));
+    ready_count = 0;
+    for (i = 0; i < n; ++i) {
+        if (indeg[i] == 0) ready_array[ready_count++] = i;
+    }
+
+    item_array = calloc(n, sizeof(lv2h_sched_item_t));
+    last_plug = NULL;
+    for (r = 0; r < n && ready_count > 0; ++r) {
+        pick = 0;
+        for (j = 0; j < ready_count; ++j) {
+            if (sched->item_array[ready_array[j]].inst->plug == last_plug) {
+                pick = j;
+                break;
+            }
+            if (ready_array[j] < ready_array[pick]) pick = j;
+        }
+        i = ready_array[pick];
+        ready_array[pick] = ready_array[--ready_count];
+        item_array[r] = sched->item_array[i];
+        last_plug = item_array[r].inst->plug;
+        for (j = succ_start[i]; j < succ_start[i + 1]; ++j) {
+            if (--indeg[succ_array[j]] == 0) ready_array[ready_count++] = succ_array[j];
+        }
+    }
+
+    // Every dependency points forward in the post-order, so all n are
+    // always placed. Keep the original order if that ever fails to hold.
+    if (r == n) {
+        memcpy(sched->item_array, item_array, n * sizeof(lv2h_sched_item_t));
+    }
+
+    free(item_array);
+    free(ready_array);
+    free(indeg);
+    free(succ_array);
+    free(succ_fill);
+    free(succ_start);
+    if (dep_array) free(dep_array);
+    return LV2H_OK;
+}
+
+static int lv2h_graph_is_frozen(lv2h_sched_t *sched, lv2h_inst_t *inst) {
+    // The root of an offline render runs normally even though it is frozen
+    return inst->is_frozen && inst != sched->root;
+}
+
+static int lv2h_graph_add_edge(lv2h_sched_t *sched, size_t *edge_cap, lv2h_port_t *reader_port, lv2h_port_t *writer_port, float *writer_block, int is_first) {
+    lv2h_sched_edge_t *edge;
+    if (sched->edge_count >= *edge_cap) {
+        *edge_cap = *edge_cap ? *edge_cap * 2 : 16;
+        sched->edge_array = realloc(sched->edge_array, *edge_cap * sizeof(lv2h_sched_edge_t));
+    }
+    edge = sched->edge_array + sched->edge_count;
+    edge->reader_port = reader_port;
+    edge->writer_port = writer_port;
+    edge->writer_block = writer_block;
+    edge->is_first = is_first;
+    edge->latency_line = NULL;
+    sched->edge_count += 1;
+    return LV2H_OK;
+}
+
+static long lv2h_graph_input_latency(lv2h_sched_t *sched, lv2h_inst_t *inst) {
+    lv2h_port_t *port;
+    lv2h_conn_t *conn;
+    lv2h_inst_t *writer_inst;
+    long latency;
+    uint32_t p;
+
+    // Feedback edges and writers still rendering offline do not count
+    latency = 0;
+    for (p = 0; p < inst->audio_in_count; ++p) {
+        port = inst->audio_in_array[p];
+        LL_FOREACH(port->conn_list, conn) {
+            writer_inst = conn->writer_port->inst;
+            if (conn->is_feedback) continue;
+            if (lv2h_graph_is_frozen(sched, writer_inst) && !writer_inst->freeze) continue;
+            if (writer_inst->path_latency > latency) latency = writer_inst->path_latency;
+        }
+    }
+    return latency;
+}
+
+static int lv2h_graph_add_delay_port(lv2h_sched_t *sched, size_t *delay_cap, lv2h_port_t *port) {
+    size_t i;
+    for (i = 0; i < sched->delay_port_count; ++i) {
+        if (sched->delay_port_array[i] == port) return LV2H_OK;
+    }
+    if (sched->delay_port_count >= *delay_cap) {
+        *delay_cap = *delay_cap ? *delay_cap * 2 : 4;
+        sched->delay_port_array = realloc(sched->delay_port_array, *delay_cap * sizeof(lv2h_port_t*));
+    }
+    sched->delay_port_array[sched->delay_port_count++] = port;
+    return LV2H_OK;
+}
+
+static int lv2h_graph_update_activation(lv2h_t *host, int deactivate) {
+    lv2h_plug_t *plug, *plug_tmp;
+    lv2h_inst_t *inst;
+    int unreachable_count;
+
+    unreachable_count = 0;
+    HASH_ITER(hh, host->plugin_map, plug, plug_tmp) {
+        LL_FOREACH(plug->inst_list, inst) {
+            // The deactivate pass reuses reachability from the compile pass
+            if (!deactivate) {
+                inst->is_reachable = inst->graph_gen == host->graph_gen;
+            }
+            if (inst->is_reachable) {
+                if (!inst->is_active) {
+                    if (inst->lilv_inst) lilv_instance_activate(inst->lilv_inst);
+                    inst->is_active = 1;
+                }
+            } else if (inst->is_active && !inst->is_rendering) {
+                // Instances run offline by lv2h_inst_freeze stay active
+                unreachable_count += 1;
+                if (deactivate) {
+                    if (inst->lilv_inst) lilv_instance_deactivate(inst->lilv_inst);
+                    inst->is_active = 0;
+                }
+            }
+        }
+    }
+    return unreachable_count;
+}
+
+static int lv2h_graph_reclaim(lv2h_t *host) {
+    lv2h_sched_t *sched, *sched_tmp, *in_use;
+    in_use = __atomic_load_n(&host->sched_in_use, __ATOMIC_SEQ_CST);
+    LL_FOREACH_SAFE(host->sched_retired_list, sched, sched_tmp) {
+        if (sched != in_use) {
+            LL_DELETE(host->sched_retired_list, sched);
+            lv2h_sched_free(sched);
+        }
+    }
+    return LV2H_OK;
+}
+
+void lv2h_sched_free(lv2h_sched_t *sched) {
+    size_t i;
+    for (i = 0; i < sched->latency_line_count; ++i) {
+        lv2h_latency_line_release(sched->latency_line_array[i]);
+    }
+    if (sched->latency_line_array) free(sched->latency_line_array);
+    if (sched->item_array) free(sched->item_array);
+    if (sched->edge_array) free(sched->edge_array);
+    if (sched->delay_port_array) free(sched->delay_port_array);
+    free(sched);
+}
@@ -6,32 +6,52 @@ static int lv2h_inst_xnnect_to_audio(lv2h_inst_t *writer_inst, char *writer_port
 static int lv2h_inst_get_port(lv2h_inst_t *inst, char *port_name, int is_audio, int is_midi, int is_ctl, int is_input, lv2h_port_t **out_port);
 static int lv2h_inst_get_audio_output_port(lv2h_inst_t *inst, char *port_name, lv2h_port_t **out_port);
 static int lv2h_inst_get_audio_input_port(lv2h_inst_t *inst, char *port_name, lv2h_port_t **out_port);
-static int lv2h_inst_get_midi_input_port(lv2h_inst_t *inst, char *port_name, lv2h_port_t **out_port);
-static int lv2h_inst_get_control_port(lv2h_inst_t *inst, char *port_name, lv2h_port_t **out_port);
 static LV2_URID lv2h_map_uri(LV2_URID_Map_Handle handle, const char *uri);
 static const char *lv2h_unmap_uri(LV2_URID_Map_Handle handle, LV2_URID urid);
-static void lv2h_inst_set_port_value(const char *port_name, void *user_data, const void *value, uint32_t size, uint32_t type);
-static uint32_t lv2h_inst_port_index(lv2h_inst_t *inst, const char *port_name);
+static void lv2h_set_option(lv2h_t *host, int index, const char *key_uri, int32_t *value);
 static int lv2h_port_init(lv2h_port_t *port, uint32_t port_index, lv2h_inst_t *inst);
 static int lv2h_port_deinit(lv2h_port_t *port);
-static int lv2h_run_plugin_inst(lv2h_inst_t *inst, int frame_count, uintmax_t audio_iter, int depth);
+static int lv2h_port_get_kind(lv2h_t *host, const LilvPlugin *lilv_plug, const LilvPort *lilv_port);
+static size_t lv2h_port_get_size(lv2h_t *host, int kind);
+static int lv2h_plug_size_arena(lv2h_plug_t *plug);
+static void *lv2h_arena_take(lv2h_inst_t *inst, size_t size);
+static char *lv2h_arena_strdup(lv2h_inst_t *inst, const char *str);
+static int lv2h_inst_index_ports(lv2h_inst_t *inst);
+static int lv2h_inst_remove_conns(lv2h_inst_t *inst);
+static int lv2h_conn_free(lv2h_conn_t *conn);
+
+#define LV2H_PORT_KIND_OTHER     0
+#define LV2H_PORT_KIND_CONTROL   1
+#define LV2H_PORT_KIND_AUDIO_IN  2
+#define LV2H_PORT_KIND_AUDIO_OUT 3
+#define LV2H_PORT_KIND_ATOM_IN   4
+#define LV2H_PORT_KIND_ATOM_OUT  5
+#define LV2H_ARENA_ROUND(n) (((n) + LV2H_ARENA_ALIGN - 1) & ~(size_t)(LV2H_ARENA_ALIGN - 1))
 
 typedef struct _lv2h_note_on_t lv2h_note_on_t;
 
 struct _lv2h_note_on_t {
-    lv2h_inst_t *inst;
-    char *port_name;
+    lv2h_port_t *port;
     uint8_t msg[3];
 };
 
 int lv2h_new(uint32_t sample_rate, size_t block_size, long tick_ms, lv2h_t **out_lv2h) {
     lv2h_t *host;
+    lv2h_port_t *port;
+    char port_name[32];
+    int i;
 
     host = calloc(1, sizeof(lv2h_t));
 
     host->sample_rate = sample_rate;
     host->tick_ns = tick_ms * 1000000L;
     host->block_size = block_size;
+    host->sink_fd = -1;
+    host->sleep_enabled = 0; // opt in, see lv2h_set_sleep
+    host->group_plugs = 1;
+    host->default_tail_frames = (LV2H_DEFAULT_TAIL_MS * (long)sample_rate) / 1000L;
+    host->sink_realtime = 1;
+    host->out_offset = (int)block_size; // nothing rendered yet
 
     host->lilv_world = lilv_world_new();
     lilv_world_load_all(host->lilv_world);
@@ -43,6 +63,7 @@ int lv2h_new(uint32_t sample_rate, size_t block_size, long tick_ms, lv2h_t **out
     host->lv2_core_AudioPort   = lilv_new_uri(host->lilv_world, LV2_CORE__AudioPort);
     host->lv2_core_ControlPort = lilv_new_uri(host->lilv_world, LV2_CORE__ControlPort);
     host->lv2_core_CVPort      = lilv_new_uri(host->lilv_world, LV2_CORE__CVPort);
+    host->lv2_core_reportsLatency = lilv_new_uri(host->lilv_world, LV2_CORE__reportsLatency);
     host->lv2_atom_AtomPort    = lilv_new_uri(host->lilv_world, LV2_ATOM__AtomPort);
     host->lv2_atom_Sequence    = lilv_new_uri(host->lilv_world, LV2_ATOM__Sequence);
     host->lv2_urid_map         = lilv_new_uri(host->lilv_world, LV2_URID__map);
@@ -57,9 +78,36 @@ int lv2h_new(uint32_t sample_rate, size_t block_size, long tick_ms, lv2h_t **out
     host->feature_unmap.URI  = LV2_URID_UNMAP_URI;
     host->feature_unmap.data = &host->urid_unmap;
 
-    host->features[0] = &host->feature_map;
-    host->features[1] = &host->feature_unmap;
-    host->features[2] = NULL;
+    // Every run is exactly block_size frames, rebuffered at the device
+    // if need be, so plugins may take their fixed size code paths
+    host->opt_block_length  = (int32_t)block_size;
+    host->opt_sequence_size = LV2H_SEQUENCE_SIZE;
+    lv2h_set_option(host, 0, LV2_BUF_SIZE__minBlockLength, &host->opt_block_length);
+    lv2h_set_option(host, 1, LV2_BUF_SIZE__maxBlockLength, &host->opt_block_length);
+    lv2h_set_option(host, 2, LV2_BUF_SIZE__nominalBlockLength, &host->opt_block_length);
+    lv2h_set_option(host, 3, LV2_BUF_SIZE__sequenceSize, &host->opt_sequence_size);
+    // options[4] stays zeroed as the terminator
+    host->feature_options.URI       = LV2_OPTIONS__options;
+    host->feature_options.data      = host->options;
+    host->feature_bounded_block.URI = LV2_BUF_SIZE__boundedBlockLength;
+    host->feature_fixed_block.URI   = LV2_BUF_SIZE__fixedBlockLength;
+    host->feature_pow2_block.URI    = LV2_BUF_SIZE__powerOf2BlockLength;
+
+    i = 0;
+    host->features[i++] = &host->feature_map;
+    host->features[i++] = &host->feature_unmap;
+    host->features[i++] = &host->feature_options;
+    host->features[i++] = &host->feature_bounded_block;
+    host->features[i++] = &host->feature_fixed_block;
+    if (block_size > 0 && (block_size & (block_size - 1)) == 0) {
+        host->features[i++] = &host->feature_pow2_block;
+    }
+    host->features[i] = NULL;
+
+    // Mapped up front so the audio thread never calls into the URI map
+    host->urid_midi_event = lv2h_map_uri(host, LV2_MIDI__MidiEvent);
+    host->msg_ring = calloc(LV2H_MSG_RING_SIZE, sizeof(lv2h_msg_t));
+    host->ts_lead_need = -1;
 
     host->audio_plug = calloc(1, sizeof(lv2h_plug_t));
     host->audio_plug->host = host;
@@ -68,10 +116,28 @@ int lv2h_new(uint32_t sample_rate, size_t block_size, long tick_ms, lv2h_t **out
     host->audio_inst = calloc(1, sizeof(lv2h_inst_t));
     host->audio_inst->plug = host->audio_plug;
     host->audio_inst->port_array = calloc(2, sizeof(lv2h_port_t));
-    host->audio_inst->port_array[0].reader_block_mixed = calloc(block_size, sizeof(float));
-    host->audio_inst->port_array[1].reader_block_mixed = calloc(block_size, sizeof(float));
+    for (i = 0; i < 2; ++i) {
+        port = host->audio_inst->port_array + i;
+        snprintf(port_name, sizeof(port_name), "playback_%d", i + 1);
+        port->inst = host->audio_inst;
+        port->port_index = i;
+        port->port_name = strdup(port_name);
+        port->reader_block_mixed = calloc(block_size, sizeof(float));
+    }
+    lv2h_inst_index_ports(host->audio_inst);
 
-    pthread_mutex_init(&host->mutex, NULL);
+    for (i = 0; i < LV2H_THREAD_COUNT; ++i) {
+        host->rt_config[i].cpu = -1;
+        host->rt_config[i].denormals_off = (i == LV2H_THREAD_AUDIO || i == LV2H_THREAD_WORKER);
+    }
+
+    host->log_level = LV2H_LOG_OFF;
+    pthread_mutex_init(&host->log_mutex, NULL);
+    pthread_mutex_init(&host->trace_mutex, NULL);
+
+    pthread_mutex_init(&host->graph_mutex, NULL);
+
+    lv2h_graph_compile(host);
 
     *out_lv2h = host;
     return LV2H_OK;
@@ -81,25 +147,62 @@ int lv2h_free(lv2h_t *host) {
     // TODO ensure clean shutdown with valgrind
 
     lv2h_plug_t *plug, *plug_tmp;
+    lv2h_pool_t *pool, *pool_tmp;
+    lv2h_midi_t *midi, *midi_tmp;
+    uint32_t i;
+
+    for (i = 0; i < LV2H_REC_MAX; ++i) {
+        if (host->rec_array[i]) lv2h_rec_free(host->rec_array[i]);
+    }
 
-    pthread_mutex_destroy(&host->mutex);
+    LL_FOREACH_SAFE(host->midi_list, midi, midi_tmp) {
+        lv2h_midi_free(midi);
+    }
+
+    LL_FOREACH_SAFE(host->pool_list, pool, pool_tmp) {
+        lv2h_pool_free(pool);
+    }
+
+    lv2h_log_free(host);
+    pthread_mutex_destroy(&host->log_mutex);
+    lv2h_trace_free(host);
+    pthread_mutex_destroy(&host->trace_mutex);
 
     HASH_ITER(hh, host->plugin_map, plug, plug_tmp) {
-        lv2h_plug_free(plug);
-        HASH_DEL(host->plugin_map, plug);
+        lv2h_plug_free(plug); // also removes plug from plugin_map
     }
 
-    free(host->audio_inst->port_array[0].reader_block_mixed);
-    free(host->audio_inst->port_array[1].reader_block_mixed);
+    lv2h_graph_free(host);
+    free(host->msg_ring);
+    pthread_mutex_destroy(&host->graph_mutex);
+
+    for (i = 0; i < 2; ++i) {
+        free(host->audio_inst->port_array[i].port_name);
+        free(host->audio_inst->port_array[i].reader_block_mixed);
+    }
     free(host->audio_inst->port_array);
+    free(host->audio_inst->port_kind_array);
     free(host->audio_inst);
     free(host->audio_plug);
 
+    if (host->input_inst) {
+        for (i = 0; i < host->input_plug->port_count; ++i) {
+            HASH_DEL(host->input_inst->port_map, host->input_inst->port_array + i);
+            free(host->input_inst->port_array[i].port_name);
+            free(host->input_inst->port_array[i].writer_block);
+        }
+        free(host->input_inst->port_array);
+        free(host->input_inst->port_kind_array);
+        free(host->input_inst);
+        free(host->input_plug);
+    }
+
     lilv_node_free(host->lv2_core_InputPort);
     lilv_node_free(host->lv2_core_OutputPort);
     lilv_node_free(host->lv2_core_AudioPort);
     lilv_node_free(host->lv2_core_ControlPort);
     lilv_node_free(host->lv2_core_CVPort);
+    lilv_node_free(host->lv2_core_reportsLatency);
     lilv_node_free(host->lv2_atom_AtomPort);
     lilv_node_free(host->lv2_atom_Sequence);
     lilv_node_free(host->lv2_urid_map);
@@ -113,15 +216,58 @@ int lv2h_free(lv2h_t *host) {
     return LV2H_OK;
 }
 
+int lv2h_set_audio_input(lv2h_t *host, int channel_count) {
+    lv2h_port_t *port;
+    char port_name[32];
+    int i;
+
+    if (host->input_inst) {
+        LV2H_RETURN_ERR(host, "lv2h_set_audio_input: audio input already set\n%s", "");
+    }
+    if (channel_count < 1) {
+        LV2H_RETURN_ERR(host, "lv2h_set_audio_input: invalid channel_count %d\n", channel_count);
+    }
+
+    // Capture channels are writer ports on a host-owned instance, mirroring
+    // `host->audio_inst` for output. Connect them with lv2h_inst_connect.
+    host->input_plug = calloc(1, sizeof(lv2h_plug_t));
+    host->input_plug->host = host;
+    host->input_plug->port_count = channel_count;
+
+    host->input_inst = calloc(1, sizeof(lv2h_inst_t));
+    host->input_inst->plug = host->input_plug;
+    host->input_inst->port_array = calloc(channel_count, sizeof(lv2h_port_t));
+    for (i = 0; i < channel_count; ++i) {
+        port = host->input_inst->port_array + i;
+        snprintf(port_name, sizeof(port_name), "capture_%d", i + 1);
+        port->inst = host->input_inst;
+        port->port_index = i;
+        port->port_name = strdup(port_name);
+        port->writer_block = calloc(host->block_size, sizeof(float));
+        HASH_ADD_STR(host->input_inst->port_map, port_name, port);
+    }
+    lv2h_inst_index_ports(host->input_inst);
+
+    return LV2H_OK;
+}
+
 int lv2h_plug_new(lv2h_t *host, char *uri_str, lv2h_plug_t **out_plug) {
     lv2h_plug_t *plug;
 
+    HASH_FIND_STR(host->plugin_map, uri_str, plug);
+    if (plug) {
+        *out_plug = plug;
+        return LV2H_OK;
+    }
+
     plug = calloc(1, sizeof(lv2h_plug_t));
     plug->host = host;
     plug->lilv_uri = lilv_new_uri(host->lilv_world, uri_str);
     plug->uri_str = strdup(uri_str);
+    plug->trace_name = lv2h_trace_intern(host, uri_str);
     if (!(plug->lilv_plugin = lilv_plugins_get_by_uri(host->lilv_plugins, plug->lilv_uri))) {
         lilv_node_free(plug->lilv_uri);
+        free(plug->uri_str);
         free(plug);
         LV2H_RETURN_ERR(host, "lv2h_plug_new: plugin not found for uri %s\n", uri_str);
     }
@@ -131,6 +277,9 @@ int lv2h_plug_new(lv2h_t *host, char *uri_str, lv2h_plug_t **out_plug) {
     plug->port_defaults = calloc(plug->port_count, sizeof(float));
 
     lilv_plugin_get_port_ranges_float(plug->lilv_plugin, plug->port_mins, plug->port_maxs, plug->port_defaults);
+    lv2h_plug_size_arena(plug);
+
+    HASH_ADD_KEYPTR(hh, host->plugin_map, plug->uri_str, strlen(plug->uri_str), plug);
 
     *out_plug = plug;
 
@@ -140,36 +289,72 @@ int lv2h_plug_new(lv2h_t *host, char *uri_str, lv2h_plug_t **out_plug) {
 int lv2h_plug_free(lv2h_plug_t *plugin) {
     lv2h_inst_t *inst, *inst_tmp;
     LL_FOREACH_SAFE(plugin->inst_list, inst, inst_tmp) {
-        lv2h_inst_free(inst);
-        LL_DELETE(plugin->inst_list, inst);
+        lv2h_inst_free(inst); // also removes inst from inst_list
     }
+    lv2h_preset_free_all(plugin);
+    HASH_DEL(plugin->host->plugin_map, plugin);
     lilv_node_free(plugin->lilv_uri);
     free(plugin->uri_str);
+    free(plugin->port_mins);
+    free(plugin->port_maxs);
+    free(plugin->port_defaults);
     free(plugin);
     return LV2H_OK;
 }
 
 
 int lv2h_inst_new(lv2h_plug_t *plug, lv2h_inst_t **out_inst) {
+    LilvInstance *lilv_inst;
+    // Fails e.g. if the plugin requires a feature we do not provide, such
+    // as powerOf2BlockLength with an odd block size
+    if (!(lilv_inst = lilv_plugin_instantiate(plug->lilv_plugin, (float)plug->host->sample_rate, plug->host->features))) {
+        LV2H_RETURN_ERR(plug->host, "lv2h_inst_new: could not instantiate %s\n", plug->uri_str);
+    }
+    if (lv2h_inst_init(plug, lilv_inst, out_inst) != LV2H_OK) {
+        lilv_instance_free(lilv_inst);
+        return LV2H_ERR;
+    }
+    return LV2H_OK;
+}
+
+int lv2h_inst_init(lv2h_plug_t *plug, LilvInstance *lilv_inst, lv2h_inst_t **out_inst) {
     lv2h_inst_t *inst;
     lv2h_port_t *port;
     uint32_t i;
 
     inst = calloc(1, sizeof(lv2h_inst_t));
+
+    // Ports, their buffers and names all come out of one block. Buffers
+    // are cache line aligned and padded so vector loops need no tail.
+    if (posix_memalign((void**)&inst->arena, LV2H_ARENA_ALIGN, plug->arena_size) != 0) {
+        free(inst);
+        LV2H_RETURN_ERR(plug->host, "lv2h_inst_init: could not allocate %zu bytes\n", plug->arena_size);
+    }
+    memset(inst->arena, 0, plug->arena_size);
+    inst->arena_size = plug->arena_size;
+    inst->arena_high = plug->arena_size;
+
     inst->plug = plug;
-    inst->lilv_inst = lilv_plugin_instantiate(plug->lilv_plugin, (float)plug->host->sample_rate, plug->host->features);
-    inst->port_array = calloc(plug->port_count, sizeof(lv2h_port_t));
+    inst->tail_frames = -1;
+    inst->lilv_inst = lilv_inst;
+    inst->port_array = lv2h_arena_take(inst, plug->port_count * sizeof(lv2h_port_t));
+    pthread_mutex_init(&inst->mutex, NULL);
 
     for (i = 0; i < plug->port_count; ++i) {
         port = inst->port_array + i;
         lv2h_port_init(port, i, inst);
         HASH_ADD_STR(inst->port_map, port_name, port);
     }
-
-    lilv_instance_activate(inst->lilv_inst);
+    lv2h_inst_index_ports(inst);
 
     LL_APPEND(plug->inst_list, inst);
 
+    // With pruning, activation waits until the instance is reachable
+    if (!plug->host->prune_deactivate) {
+        if (inst->lilv_inst) lilv_instance_activate(inst->lilv_inst);
+        inst->is_active = 1;
+    }
+
     *out_inst = inst;
 
     return LV2H_OK;
@@ -179,23 +364,114 @@ int lv2h_inst_new(lv2h_plug_t *plug, lv2h_inst_t **out_inst) {
 int lv2h_inst_free(lv2h_inst_t *inst) {
     uint32_t i;
 
+    // Take the instance out of the schedule and wait for the audio thread
+    // to let go of it and any messages queued for it
+    lv2h_midi_purge_inst(inst);
+    lv2h_msg_purge_inst(inst);
+    lv2h_rec_purge_inst(inst);
+    lv2h_inst_remove_conns(inst);
+    lv2h_graph_compile(inst->plug->host);
+    lv2h_graph_sync(inst->plug->host);
+    lv2h_freeze_free(inst);
+
     LL_DELETE(inst->plug->inst_list, inst);
 
-    lilv_instance_deactivate(inst->lilv_inst);
+    if (inst->is_active && inst->lilv_inst) {
+        lilv_instance_deactivate(inst->lilv_inst);
+    }
 
     for (i = 0; i < inst->plug->port_count; ++i) {
         lv2h_port_deinit(&inst->port_array[i]);
         HASH_DEL(inst->port_map, inst->port_array + i);
     }
 
-    free(inst->port_array);
-    lilv_instance_free(inst->lilv_inst);
+    lv2h_bridge_free(inst);
+
+    free(inst->arena);
+    free(inst->port_kind_array);
+    pthread_mutex_destroy(&inst->mutex);
+    if (inst->lilv_inst) lilv_instance_free(inst->lilv_inst);
 
     free(inst);
 
     return LV2H_OK;
 }
 
+int lv2h_inst_lock(lv2h_inst_t *inst) {
+    lv2h_lock_stats_t *stats;
+    long begin_ns, wait_ns, max_ns;
+
+    if (pthread_mutex_trylock(&inst->mutex) == 0) {
+        return LV2H_OK;
+    }
+
+    // Waiting out at most one run of this instance
+    stats = &inst->plug->host->lock_stats;
+    begin_ns = lv2h_trace_now_ns();
+    pthread_mutex_lock(&inst->mutex);
+    wait_ns = lv2h_trace_now_ns() - begin_ns;
+    __sync_fetch_and_add(&stats->contended, 1);
+    __sync_fetch_and_add(&stats->wait_ns, wait_ns);
+    max_ns = __atomic_load_n(&stats->wait_max_ns, __ATOMIC_RELAXED);
+    while (wait_ns > max_ns && !__atomic_compare_exchange_n(&stats->wait_max_ns, &max_ns, wait_ns, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    return LV2H_OK;
+}
+
+int lv2h_inst_unlock(lv2h_inst_t *inst) {
+    pthread_mutex_unlock(&inst->mutex);
+    return LV2H_OK;
+}
+
+int lv2h_get_lock_stats(lv2h_t *host, lv2h_lock_stats_t *out_stats) {
+    out_stats->run_skipped = __atomic_load_n(&host->lock_stats.run_skipped, __ATOMIC_RELAXED);
+    out_stats->contended = __atomic_load_n(&host->lock_stats.contended, __ATOMIC_RELAXED);
+    out_stats->wait_ns = __atomic_load_n(&host->lock_stats.wait_ns, __ATOMIC_RELAXED);
+    out_stats->wait_max_ns = __atomic_load_n(&host->lock_stats.wait_max_ns, __ATOMIC_RELAXED);
+    return LV2H_OK;
+}
+
+int lv2h_get_capture_stats(lv2h_t *host, unsigned long *out_overflows, unsigned long *out_underflows) {
+    if (out_overflows) *out_overflows = __atomic_load_n(&host->capture_overflow_count, __ATOMIC_RELAXED);
+    if (out_underflows) *out_underflows = __atomic_load_n(&host->capture_underflow_count, __ATOMIC_RELAXED);
+    return LV2H_OK;
+}
+
+int lv2h_inst_get_mem_stats(lv2h_inst_t *inst, lv2h_mem_stats_t *out_stats) {
+    uint32_t p;
+
+    out_stats->arena_bytes = inst->arena_size;
+    out_stats->payload_bytes = inst->arena_payload;
+    out_stats->heap_bytes = sizeof(lv2h_inst_t) + inst->plug->port_count * sizeof(lv2h_port_t*);
+    for (p = 0; p < inst->plug->port_count; ++p) {
+        if (inst->port_array[p].feedback_block) {
+            out_stats->heap_bytes += inst->plug->host->block_size * sizeof(float);
+        }
+    }
+    return LV2H_OK;
+}
+
+int lv2h_mem_report(lv2h_t *host, FILE *fp) {
+    lv2h_plug_t *plug, *plug_tmp;
+    lv2h_inst_t *inst;
+    lv2h_mem_stats_t stats;
+    size_t arena_total, heap_total;
+
+    // Plugin-internal allocations are not visible to the host
+    arena_total = 0;
+    heap_total = 0;
+    fprintf(fp, "%-16s %10s %10s %10s %s\n", "inst", "arena", "payload", "heap", "plugin");
+    HASH_ITER(hh, host->plugin_map, plug, plug_tmp) {
+        LL_FOREACH(plug->inst_list, inst) {
+            lv2h_inst_get_mem_stats(inst, &stats);
+            fprintf(fp, "%-16p %10zu %10zu %10zu %s\n", (void*)inst, stats.arena_bytes, stats.payload_bytes, stats.heap_bytes, plug->uri_str);
+            arena_total += stats.arena_bytes;
+            heap_total += stats.heap_bytes;
+        }
+    }
+    fprintf(fp, "total arena %zu heap %zu\n", arena_total, heap_total);
+    return LV2H_OK;
+}
+
 int lv2h_inst_connect(lv2h_inst_t *writer_inst, char *writer_port_name, lv2h_inst_t *reader_inst, char *reader_port_name) {
     return lv2h_inst_xnnect(writer_inst, writer_port_name, reader_inst, reader_port_name, 0);
 }
@@ -213,22 +489,11 @@ int lv2h_inst_disconnect_from_audio(lv2h_inst_t *writer_inst, char *writer_port_
 }
 
 int lv2h_inst_send_midi(lv2h_inst_t *inst, char *port_name, uint8_t *bytes, int bytes_len) {
-    lv2h_t *host;
     lv2h_port_t *port;
-    LV2_Evbuf_Iterator end;
-
-    host = inst->plug->host;
-
     if (lv2h_inst_get_midi_input_port(inst, port_name, &port) != LV2H_OK) {
         return LV2H_ERR;
     }
-
-    pthread_mutex_lock(&host->mutex);
-    end = lv2_evbuf_end(port->atom_input); // TODO _begin?
-    lv2_evbuf_write(&end, 0, 0, lv2h_map_uri(inst->plug->host, LV2_MIDI__MidiEvent), bytes_len, bytes);
-    printf("lv2h_inst_send_midi %p %lu %02x %02x %02x size=%u\n", inst, host->audio_iter,  bytes[0], bytes[1], bytes[2], lv2_evbuf_get_size(port->atom_input));
-    pthread_mutex_unlock(&host->mutex);
-    return LV2H_OK;
+    return lv2h_port_send_midi(port, bytes, bytes_len);
 }
 
 int lv2h_inst_set_param(lv2h_inst_t *inst, char *port_name, float val) {
@@ -236,19 +501,47 @@ int lv2h_inst_set_param(lv2h_inst_t *inst, char *port_name, float val) {
     if (lv2h_inst_get_control_port(inst, port_name, &port) != LV2H_OK) {
         return LV2H_ERR;
     }
-    port->control_val = val;
-    return LV2H_OK;
+    return lv2h_port_set_param(port, val);
 }
 
 int lv2h_inst_play(lv2h_inst_t *inst, char *port_name, int chan, int note1, int note2, int note3, int note4, int vel, int len_ms) {
+    lv2h_port_t *port;
+    if (lv2h_inst_get_midi_input_port(inst, port_name, &port) != LV2H_OK) {
+        return LV2H_ERR;
+    }
+    return lv2h_port_play(port, chan, note1, note2, note3, note4, vel, len_ms);
+}
+
+int lv2h_port_send_midi(lv2h_port_t *port, uint8_t *bytes, int bytes_len) {
     lv2h_t *host;
+    long trace_ns;
+    int rv;
+
+    host = port->inst->plug->host;
+    if (bytes_len < 1) {
+        LV2H_RETURN_ERR(host, "lv2h_port_send_midi: empty message\n%s", "");
+    }
+    trace_ns = LV2H_TRACE_BEGIN(host);
+    rv = lv2h_msg_push(host, port, LV2H_MSG_MIDI, bytes, bytes_len, 0.f);
+    LV2H_LOG(host, LV2H_LOG_DEBUG, "lv2h_port_send_midi %p %ju %02x %02x %02x\n", (void*)port->inst, host->audio_iter, bytes[0], bytes_len > 1 ? bytes[1] : 0, bytes_len > 2 ? bytes[2] : 0);
+    LV2H_TRACE_END(host, "midi", port->inst, trace_ns);
+    return rv;
+}
+
+int lv2h_port_set_param(lv2h_port_t *port, float val) {
+    return lv2h_msg_push(port->inst->plug->host, port, LV2H_MSG_PARAM, NULL, 0, val);
+}
+
+int lv2h_port_play(lv2h_port_t *port, int chan, int note1, int note2, int note3, int note4, int vel, int len_ms) {
+    lv2h_t *host;
+    lv2h_batch_t batch;
     lv2h_note_on_t *note_on;
     uint8_t notes[4];
     uint8_t msg[3];
     int notes_len;
     int i;
 
-    host = inst->plug->host;
+    host = port->inst->plug->host;
 
     notes_len = 0;
     if (note1 > 0) notes[notes_len++] = note1;
@@ -256,45 +549,32 @@ int lv2h_inst_play(lv2h_inst_t *inst, char *port_name, int chan, int note1, int
     if (note3 > 0) notes[notes_len++] = note3;
     if (note4 > 0) notes[notes_len++] = note4;
 
+    // Chord notes go out together in one block
+    lv2h_batch_begin(host, &batch);
     for (i = 0; i < notes_len; ++i) {
         msg[0] = 0x90 + (chan >= 0x00 && chan <= 0x0f ? chan : 0x00);
         msg[1] = notes[i];
         msg[2] = (uint8_t)vel;
-        if (lv2h_inst_send_midi(inst, port_name, msg, 3) != LV2H_OK) {
-            return LV2H_ERR;
-        }
+        lv2h_batch_midi(&batch, port, 0, msg, 3);
+    }
+    if (lv2h_batch_commit(&batch) != LV2H_OK) {
+        return LV2H_ERR;
+    }
+
+    for (i = 0; i < notes_len; ++i) {
+        msg[0] = 0x90 + (chan >= 0x00 && chan <= 0x0f ? chan : 0x00);
+        msg[1] = notes[i];
         note_on = calloc(1, sizeof(lv2h_note_on_t)); // TODO preallocate note offs
-        note_on->inst = inst;
-        note_on->port_name = port_name; // TODO strdup or use port pointer?
+        note_on->port = port;
         note_on->msg[0] = msg[0];
         note_on->msg[1] = msg[1];
-        note_on->msg[2] = msg[2];
+        note_on->msg[2] = (uint8_t)vel;
         // Set audio_run_delay=1 to prevent a note_off on the same run as a note on
         lv2h_schedule_event(host, host->ts_now_ns + (len_ms * 1000000L), 1, lv2h_process_note_off, note_on);
     }
     return LV2H_OK;
 }
 
-int lv2h_inst_load_preset(lv2h_inst_t *inst, char *preset_str) {
-    LilvNode *preset;
-    LilvState *state;
-    lv2h_t *host;
-    host = inst->plug->host;
-    preset = lilv_new_uri(host->lilv_world, preset_str);
-    state = lilv_state_new_from_world(host->lilv_world, &host->urid_map, preset);
-    if (!state) {
-        LV2H_RETURN_ERR(host, "lv2h_inst_load_preset: preset not found for %s\n", preset_str);
-    }
-    lilv_state_restore(state, inst->lilv_inst, lv2h_inst_set_port_value, inst, 0, NULL);
-    return LV2H_OK;
-}
-
-int lv2h_run_plugin_insts(lv2h_t *host, int frame_count) {
-    lv2h_run_plugin_inst(host->audio_inst, frame_count, host->audio_iter, 0);
-    __sync_fetch_and_add(&host->audio_iter, 1);
-    return LV2H_OK;
-}
-
 static int lv2h_process_note_off(lv2h_event_t *ev) {
     lv2h_note_on_t *note_on;
     int rv;
@@ -303,7 +583,7 @@ static int lv2h_process_note_off(lv2h_event_t *ev) {
     note_on->msg[0] = 0x80 + (note_on->msg[0] - 0x90);
     note_on->msg[2] = 0;
 
-    rv = lv2h_inst_send_midi(note_on->inst, note_on->port_name, note_on->msg, 3);
+    rv = lv2h_port_send_midi(note_on->port, note_on->msg, 3);
 
     free(note_on);
 
@@ -320,13 +600,7 @@ static int lv2h_inst_xnnect(lv2h_inst_t *writer_inst, char *writer_port_name, lv
         return LV2H_ERR;
     }
 
-    if (disconnect) {
-        LL_DELETE(reader_port->writer_port_list, writer_port);
-    } else {
-        LL_APPEND(reader_port->writer_port_list, writer_port);
-    }
-
-    return LV2H_OK;
+    return lv2h_port_xnnect(writer_port, reader_port, disconnect, 1);
 }
 
 static int lv2h_inst_xnnect_to_audio(lv2h_inst_t *writer_inst, char *writer_port_name, int audio_channel, int disconnect) {
@@ -342,10 +616,88 @@ static int lv2h_inst_xnnect_to_audio(lv2h_inst_t *writer_inst, char *writer_port
         return LV2H_ERR;
     }
 
+    return lv2h_port_xnnect(writer_port, host->audio_inst->port_array + audio_channel, disconnect, 1);
+}
+
+int lv2h_port_xnnect(lv2h_port_t *writer_port, lv2h_port_t *reader_port, int disconnect, int compile) {
+    lv2h_t *host;
+    lv2h_conn_t *conn;
+
+    host = reader_port->inst->plug->host;
+
+    LL_FOREACH(reader_port->conn_list, conn) {
+        if (conn->writer_port == writer_port) break;
+    }
+
     if (disconnect) {
-        LL_DELETE(host->audio_inst->port_array[audio_channel].writer_port_list, writer_port);
+        if (!conn) {
+            LV2H_RETURN_ERR(host, "lv2h_port_xnnect: %s is not connected to %s\n", writer_port->port_name, reader_port->port_name);
+        }
+        LL_DELETE(reader_port->conn_list, conn);
+        lv2h_conn_free(conn);
     } else {
-        LL_APPEND(host->audio_inst->port_array[audio_channel].writer_port_list, writer_port);
+        if (conn) {
+            LV2H_RETURN_ERR(host, "lv2h_port_xnnect: %s is already connected to %s\n", writer_port->port_name, reader_port->port_name);
+        }
+        conn = calloc(1, sizeof(lv2h_conn_t));
+        conn->writer_port = writer_port;
+        conn->reader_port = reader_port;
+        LL_APPEND(reader_port->conn_list, conn);
+        reader_port->was_connected = 1;
+    }
+
+    return compile ? lv2h_graph_compile(host) : LV2H_OK;
+}
+
+static int lv2h_conn_free(lv2h_conn_t *conn) {
+    // Schedules hold their own reference to the line
+    if (conn->latency_line) lv2h_latency_line_release(conn->latency_line);
+    free(conn);
+    return LV2H_OK;
+}
+
+static int lv2h_inst_remove_conns(lv2h_inst_t *inst) {
+    lv2h_t *host;
+    lv2h_plug_t *plug, *plug_tmp;
+    lv2h_inst_t *reader_inst;
+    lv2h_port_t *port;
+    lv2h_conn_t *conn, *conn_tmp;
+    uint32_t p;
+
+    host = inst->plug->host;
+
+    // Drop connections into this instance
+    for (p = 0; p < inst->plug->port_count; ++p) {
+        port = inst->port_array + p;
+        LL_FOREACH_SAFE(port->conn_list, conn, conn_tmp) {
+            LL_DELETE(port->conn_list, conn);
+            lv2h_conn_free(conn);
+        }
+    }
+
+    // Drop connections out of this instance
+    // TODO keep a per-instance reader list instead of scanning every port
+    HASH_ITER(hh, host->plugin_map, plug, plug_tmp) {
+        LL_FOREACH(plug->inst_list, reader_inst) {
+            for (p = 0; p < plug->port_count; ++p) {
+                port = reader_inst->port_array + p;
+                LL_FOREACH_SAFE(port->conn_list, conn, conn_tmp) {
+                    if (conn->writer_port->inst == inst) {
+                        LL_DELETE(port->conn_list, conn);
+                        lv2h_conn_free(conn);
+                    }
+                }
+            }
+        }
+    }
+    for (p = 0; p < host->audio_plug->port_count; ++p) {
+        port = host->audio_inst->port_array + p;
+        LL_FOREACH_SAFE(port->conn_list, conn, conn_tmp) {
+            if (conn->writer_port->inst == inst) {
+                LL_DELETE(port->conn_list, conn);
+                lv2h_conn_free(conn);
+            }
+        }
     }
 
     return LV2H_OK;
@@ -403,11 +755,11 @@ static int lv2h_inst_get_audio_input_port(lv2h_inst_t *inst, char *port_name, lv
     return lv2h_inst_get_port(inst, port_name, 1, 0, 0, 1, out_port);
 }
 
-static int lv2h_inst_get_midi_input_port(lv2h_inst_t *inst, char *port_name, lv2h_port_t **out_port) {
+int lv2h_inst_get_midi_input_port(lv2h_inst_t *inst, char *port_name, lv2h_port_t **out_port) {
     return lv2h_inst_get_port(inst, port_name, 0, 1, 0, 1, out_port);
 }
 
-static int lv2h_inst_get_control_port(lv2h_inst_t *inst, char *port_name, lv2h_port_t **out_port) {
+int lv2h_inst_get_control_port(lv2h_inst_t *inst, char *port_name, lv2h_port_t **out_port) {
     return lv2h_inst_get_port(inst, port_name, 0, 0, 1, 0, out_port);
 }
 
@@ -434,36 +786,15 @@ static const char *lv2h_unmap_uri(LV2_URID_Map_Handle handle, LV2_URID urid) {
     return NULL;
 }
 
-static void lv2h_inst_set_port_value(const char *port_name, void *user_data, const void *value, uint32_t size, uint32_t type) {
-    lv2h_inst_t *inst;
-    uint32_t port_index;
-    float val;
-
-    (void)size;
-
-    inst = (lv2h_inst_t*)user_data;
-
-    if (type != 0 && type != lv2h_map_uri(inst->plug->host, LV2_ATOM__Float)) {
-        return;
-    }
-
-    port_index = lv2h_inst_port_index(inst, port_name);
-    if (port_index >= inst->plug->port_count) return;
-
-    val = *((float*)value);
-    printf("%s = %f\n", port_name, val);
-
-    inst->port_array[port_index].control_val = val;
-}
-
-static uint32_t lv2h_inst_port_index(lv2h_inst_t *inst, const char *port_name) {
-    LilvNode *snode;
-    const LilvPort *port;
-    snode = lilv_new_string(inst->plug->host->lilv_world, port_name);
-    port = lilv_plugin_get_port_by_symbol(inst->plug->lilv_plugin, snode);
-    lilv_node_free(snode);
-    if (!port) return 0;
-    return lilv_port_get_index(inst->plug->lilv_plugin, port);
+static void lv2h_set_option(lv2h_t *host, int index, const char *key_uri, int32_t *value) {
+    LV2_Options_Option *option;
+    option = &host->options[index];
+    option->context = LV2_OPTIONS_INSTANCE;
+    option->subject = 0;
+    option->key = lv2h_map_uri(host, key_uri);
+    option->size = sizeof(int32_t);
+    option->type = lv2h_map_uri(host, LV2_ATOM__Int);
+    option->value = value;
 }
 
 static int lv2h_port_init(lv2h_port_t *port, uint32_t port_index, lv2h_inst_t *inst) {
@@ -472,102 +803,161 @@ static int lv2h_port_init(lv2h_port_t *port, uint32_t port_index, lv2h_inst_t *i
     const LilvPlugin *lilv_plug;
     const LilvPort *lilv_port;
     LilvInstance *lilv_inst;
+    int kind;
 
     plug = inst->plug;
     host = plug->host;
     lilv_plug = plug->lilv_plugin;
     lilv_inst = inst->lilv_inst;
     lilv_port = lilv_plugin_get_port_by_index(lilv_plug, port_index);
+    kind = lv2h_port_get_kind(host, lilv_plug, lilv_port);
 
     port->inst = inst;
     port->lilv_port = lilv_port;
     port->port_index = port_index;
-    port->port_name = strdup(lilv_node_as_string(lilv_port_get_symbol(lilv_plug, lilv_port)));
+    port->port_name = lv2h_arena_strdup(inst, lilv_node_as_string(lilv_port_get_symbol(lilv_plug, lilv_port)));
+
+    switch (kind) {
+        case LV2H_PORT_KIND_CONTROL:
+            port->control_val = plug->port_defaults[port_index];
+            port->is_control = 1;
+            if (lilv_inst) lilv_instance_connect_port(lilv_inst, port_index, &port->control_val);
+            if (lilv_port_is_a(lilv_plug, lilv_port, host->lv2_core_OutputPort)
+                && lilv_port_has_property(lilv_plug, lilv_port, host->lv2_core_reportsLatency)
+            ) {
+                inst->latency_port = port;
+            }
+            break;
+        case LV2H_PORT_KIND_AUDIO_IN:
+            port->reader_block_mixed = lv2h_arena_take(inst, lv2h_port_get_size(host, kind));
+            if (lilv_inst) lilv_instance_connect_port(lilv_inst, port_index, port->reader_block_mixed);
+            break;
+        case LV2H_PORT_KIND_AUDIO_OUT:
+            port->writer_block = lv2h_arena_take(inst, lv2h_port_get_size(host, kind));
+            if (lilv_inst) lilv_instance_connect_port(lilv_inst, port_index, port->writer_block);
+            break;
+        case LV2H_PORT_KIND_ATOM_IN:
+            port->atom_input = lv2_evbuf_init(lv2h_arena_take(inst, lv2h_port_get_size(host, kind)), LV2H_SEQUENCE_SIZE, LV2_EVBUF_ATOM, 0, lv2h_map_uri(host, LV2_ATOM__Sequence));
+            if (lilv_inst) lilv_instance_connect_port(lilv_inst, port_index, lv2_evbuf_get_buffer(port->atom_input));
+            break;
+        case LV2H_PORT_KIND_ATOM_OUT:
+            // TODO atom outputs
+            port->atom_output = lv2h_arena_take(inst, lv2h_port_get_size(host, kind));
+            if (lilv_inst) lilv_instance_connect_port(lilv_inst, port_index, port->atom_output);
+            break;
+    }
 
+    return LV2H_OK;
+}
+
+static int lv2h_port_get_kind(lv2h_t *host, const LilvPlugin *lilv_plug, const LilvPort *lilv_port) {
+    int is_input;
+    is_input = lilv_port_is_a(lilv_plug, lilv_port, host->lv2_core_InputPort);
     if (lilv_port_is_a(lilv_plug, lilv_port, host->lv2_core_ControlPort)) {
-        port->control_val = plug->port_defaults[port_index];
-        port->is_control = 1;
-        lilv_instance_connect_port(lilv_inst, port_index, &port->control_val);
+        return LV2H_PORT_KIND_CONTROL;
     } else if (lilv_port_is_a(lilv_plug, lilv_port, host->lv2_core_AudioPort) || lilv_port_is_a(lilv_plug, lilv_port, host->lv2_core_CVPort)) {
-        if (lilv_port_is_a(lilv_plug, lilv_port, host->lv2_core_InputPort)) {
-            port->reader_block_mixed = calloc(host->block_size, sizeof(float));
-            lilv_instance_connect_port(lilv_inst, port_index, port->reader_block_mixed);
-        } else {
-            port->writer_block = calloc(host->block_size, sizeof(float));
-            lilv_instance_connect_port(lilv_inst, port_index, port->writer_block);
-        }
+        return is_input ? LV2H_PORT_KIND_AUDIO_IN : LV2H_PORT_KIND_AUDIO_OUT;
     } else if (lilv_port_is_a(lilv_plug, lilv_port, host->lv2_atom_AtomPort)) {
-        if (lilv_port_is_a(lilv_plug, lilv_port, host->lv2_core_InputPort)) {
-            port->atom_input = lv2_evbuf_new(1024, LV2_EVBUF_ATOM, 0, lv2h_map_uri(host, LV2_ATOM__Sequence)); // TODO capacity
-            lilv_instance_connect_port(lilv_inst, port_index, lv2_evbuf_get_buffer(port->atom_input));
-        } else {
-            // TODO atom outputs
-            port->atom_output = (LV2_Atom_Sequence*)calloc(1, sizeof(LV2_Atom_Sequence) + 1024); // TODO capacity
-            lilv_instance_connect_port(lilv_inst, port_index, port->atom_output);
-        }
+        return is_input ? LV2H_PORT_KIND_ATOM_IN : LV2H_PORT_KIND_ATOM_OUT;
     }
+    return LV2H_PORT_KIND_OTHER;
+}
 
-    return LV2H_OK;
+static size_t lv2h_port_get_size(lv2h_t *host, int kind) {
+    switch (kind) {
+        case LV2H_PORT_KIND_AUDIO_IN:
+        case LV2H_PORT_KIND_AUDIO_OUT:
+            return host->block_size * sizeof(float);
+        case LV2H_PORT_KIND_ATOM_IN:
+            return lv2_evbuf_size(LV2H_SEQUENCE_SIZE);
+        case LV2H_PORT_KIND_ATOM_OUT:
+            return sizeof(LV2_Atom_Sequence) + LV2H_SEQUENCE_SIZE;
+    }
+    return 0;
 }
 
-static int lv2h_port_deinit(lv2h_port_t *port) {
-    free(port->port_name);
-    if (port->writer_block) free(port->writer_block);
-    if (port->reader_block_mixed) free(port->reader_block_mixed);
-    if (port->atom_input) free(port->atom_input);
-    if (port->atom_output) free(port->atom_output);
+static int lv2h_plug_size_arena(lv2h_plug_t *plug) {
+    const LilvPort *lilv_port;
+    size_t size;
+    uint32_t p;
+
+    // Aligned buffers fill the arena from the bottom and names pack in
+    // from the top, so the two never need padding between them
+    size = LV2H_ARENA_ROUND(plug->port_count * sizeof(lv2h_port_t));
+    for (p = 0; p < plug->port_count; ++p) {
+        lilv_port = lilv_plugin_get_port_by_index(plug->lilv_plugin, p);
+        size += LV2H_ARENA_ROUND(lv2h_port_get_size(plug->host, lv2h_port_get_kind(plug->host, plug->lilv_plugin, lilv_port)));
+        size += strlen(lilv_node_as_string(lilv_port_get_symbol(plug->lilv_plugin, lilv_port))) + 1;
+    }
+    plug->arena_size = LV2H_ARENA_ROUND(size > 0 ? size : 1);
     return LV2H_OK;
 }
 
-static int lv2h_run_plugin_inst(lv2h_inst_t *inst, int frame_count, uintmax_t audio_iter, int depth) {
-    lv2h_t *host;
-    lv2h_port_t *reader_port, *writer_port;
+static void *lv2h_arena_take(lv2h_inst_t *inst, size_t size) {
+    void *ptr;
+    if (size < 1) {
+        return NULL;
+    }
+    ptr = inst->arena + inst->arena_low;
+    inst->arena_low += LV2H_ARENA_ROUND(size);
+    inst->arena_payload += size;
+    return ptr;
+}
+
+static char *lv2h_arena_strdup(lv2h_inst_t *inst, const char *str) {
+    size_t len;
+    len = strlen(str) + 1;
+    inst->arena_high -= len;
+    inst->arena_payload += len;
+    memcpy(inst->arena + inst->arena_high, str, len);
+    return (char*)(inst->arena + inst->arena_high);
+}
+
+static int lv2h_inst_index_ports(lv2h_inst_t *inst) {
+    lv2h_port_t **next;
+    lv2h_port_t *port;
+    uint32_t port_count;
     uint32_t p;
-    size_t w;
-    int f;
 
-    // TODO check depth to protect againt cycles in graph
+    // Per-block work walks these instead of every port. Each kind is a
+    // contiguous run in one allocation.
+    port_count = inst->plug->port_count;
+    inst->port_kind_array = calloc(port_count > 0 ? port_count : 1, sizeof(lv2h_port_t*));
+    next = inst->port_kind_array;
 
-    host = inst->plug->host;
+    inst->audio_in_array = next;
+    for (p = 0; p < port_count; ++p) {
+        port = inst->port_array + p;
+        if (port->reader_block_mixed) *next++ = port;
+    }
+    inst->audio_in_count = next - inst->audio_in_array;
 
-    for (p = 0; p < inst->plug->port_count; ++p) {
-        reader_port = inst->port_array + p;
-        LL_FOREACH(reader_port->writer_port_list, writer_port) {
-            // TODO optimize looping over all ports like this
-            if (writer_port->inst->audio_iter != audio_iter) {
-                lv2h_run_plugin_inst(writer_port->inst, frame_count, audio_iter, depth + 1);
-            }
-        }
-        w = 0;
-        LL_FOREACH(reader_port->writer_port_list, writer_port) {
-            // TODO optimize case when there is 1 writer
-            if (w == 0) {
-                memcpy(reader_port->reader_block_mixed, writer_port->writer_block, sizeof(float) * inst->plug->host->block_size);
-            } else {
-                for (f = 0; f < host->block_size; ++f) {
-                    reader_port->reader_block_mixed[f] += writer_port->writer_block[f];
-                }
-            }
-            w += 1;
-        }
+    inst->audio_out_array = next;
+    for (p = 0; p < port_count; ++p) {
+        port = inst->port_array + p;
+        if (port->writer_block) *next++ = port;
     }
-    if (inst->audio_iter != audio_iter && inst != host->audio_inst) {
-
-        pthread_mutex_lock(&host->mutex); // TODO mutex can be per instance
-        lilv_instance_run(inst->lilv_inst, frame_count);
-        for (p = 0; p < inst->plug->port_count; ++p) {
-            // TODO optimize looping over all ports like this
-            reader_port = inst->port_array + p;
-            if (reader_port->atom_input) {
-                if (lv2_evbuf_get_size(reader_port->atom_input) > 0) {
-                    printf("atom_input size was %u\n", lv2_evbuf_get_size(reader_port->atom_input));
-                    lv2_evbuf_reset(reader_port->atom_input, 1);
-                }
-            }
-        }
-        pthread_mutex_unlock(&host->mutex);
+    inst->audio_out_count = next - inst->audio_out_array;
 
-        inst->audio_iter = audio_iter;
+    inst->atom_in_array = next;
+    for (p = 0; p < port_count; ++p) {
+        port = inst->port_array + p;
+        if (port->atom_input) *next++ = port;
     }
+    inst->atom_in_count = next - inst->atom_in_array;
+
+    inst->control_array = next;
+    for (p = 0; p < port_count; ++p) {
+        port = inst->port_array + p;
+        if (port->is_control) *next++ = port;
+    }
+    inst->control_count = next - inst->control_array;
+
+    return LV2H_OK;
+}
+
+static int lv2h_port_deinit(lv2h_port_t *port) {
+    // Everything else is in the instance arena
+    if (port->feedback_block) free(port->feedback_block);
     return LV2H_OK;
 }
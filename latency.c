@@ -0,0 +1,111 @@
+#include "lv2h.h"
+
+#define LV2H_LATENCY_MAX_FRAMES (1L << 20)
+
+static lv2h_latency_line_t *lv2h_latency_line_new(lv2h_t *host, long frames);
+
+int lv2h_get_output_latency(lv2h_t *host, long *out_frames) {
+    *out_frames = __atomic_load_n(&host->output_latency_frames, __ATOMIC_ACQUIRE);
+    return LV2H_OK;
+}
+
+void lv2h_latency_update(lv2h_inst_t *inst) {
+    long frames;
+
+    // Plugins may change their reported latency at any run, e.g. when a
+    // lookahead parameter moves. The control thread recompiles.
+    frames = (long)inst->latency_port->control_val;
+    if (frames < 0) frames = 0;
+    if (frames > LV2H_LATENCY_MAX_FRAMES) frames = LV2H_LATENCY_MAX_FRAMES;
+    if (frames != inst->latency_frames) {
+        __atomic_store_n(&inst->latency_frames, frames, __ATOMIC_RELEASE);
+        __atomic_store_n(&inst->plug->host->latency_changed, 1, __ATOMIC_RELEASE);
+    }
+}
+
+int lv2h_latency_check(lv2h_t *host) {
+    if (__atomic_exchange_n(&host->latency_changed, 0, __ATOMIC_ACQ_REL)) {
+        return lv2h_graph_compile(host);
+    }
+    return LV2H_OK;
+}
+
+lv2h_latency_line_t *lv2h_latency_line_get(lv2h_sched_t *sched, lv2h_conn_t *conn, long frames, int is_live) {
+    lv2h_latency_line_t *line;
+    lv2h_t *host;
+
+    host = conn->reader_port->inst->plug->host;
+
+    if (frames < 1) {
+        if (is_live && conn->latency_line) {
+            lv2h_latency_line_release(conn->latency_line);
+            conn->latency_line = NULL;
+        }
+        return NULL;
+    }
+
+    // Keep the live line, and the audio in it, while the length holds.
+    // Offline render schedules always get their own.
+    if (is_live && conn->latency_line && conn->latency_line->frames == frames) {
+        line = conn->latency_line;
+    } else {
+        line = lv2h_latency_line_new(host, frames);
+        if (is_live) {
+            if (conn->latency_line) lv2h_latency_line_release(conn->latency_line);
+            conn->latency_line = line;
+            __sync_fetch_and_add(&line->ref_count, 1);
+        }
+    }
+
+    __sync_fetch_and_add(&line->ref_count, 1);
+    sched->latency_line_array = realloc(sched->latency_line_array, (sched->latency_line_count + 1) * sizeof(lv2h_latency_line_t*));
+    sched->latency_line_array[sched->latency_line_count++] = line;
+    return line;
+}
+
+void lv2h_latency_line_release(lv2h_latency_line_t *line) {
+    if (__sync_sub_and_fetch(&line->ref_count, 1) == 0) {
+        free(line->buffer);
+        free(line->out_block);
+        free(line);
+    }
+}
+
+int lv2h_latency_line_run(lv2h_latency_line_t *line, float *in_block, int frame_count) {
+    long n;
+    int f;
+
+    // Once a silent writer has pushed a full line of zeros there is
+    // nothing left to play
+    if (!in_block) {
+        if (line->quiet_frames >= line->frames) {
+            return 1;
+        }
+        line->quiet_frames += frame_count;
+    } else {
+        line->quiet_frames = 0;
+    }
+
+    for (f = 0; f < frame_count; f += n) {
+        n = line->frames - line->position;
+        if (n > frame_count - f) n = frame_count - f;
+        memcpy(line->out_block + f, line->buffer + line->position, n * sizeof(float));
+        if (in_block) {
+            memcpy(line->buffer + line->position, in_block + f, n * sizeof(float));
+        } else {
+            memset(line->buffer + line->position, 0, n * sizeof(float));
+        }
+        line->position = (line->position + n) % line->frames;
+    }
+    return 0;
+}
+
+static lv2h_latency_line_t *lv2h_latency_line_new(lv2h_t *host, long frames) {
+    lv2h_latency_line_t *line;
+    line = calloc(1, sizeof(lv2h_latency_line_t));
+    line->frames = frames;
+    line->quiet_frames = frames;
+    line->buffer = calloc(frames, sizeof(float));
+    line->out_block = calloc(host->block_size, sizeof(float));
+    return line;
+}
@@ -0,0 +1,174 @@
+#include "lv2h.h"
+#include <stdarg.h>
+
+#define LV2H_LOG_DRAIN_INTERVAL_NS 10000000L
+
+static void *lv2h_log_run_drain(void *arg);
+static int lv2h_log_drain(lv2h_t *host);
+static lv2h_log_ring_t *lv2h_log_get_ring(lv2h_t *host);
+
+static const char *lv2h_log_level_names[] = { "error", "warn", "info", "debug" };
+
+static __thread lv2h_log_ring_t *lv2h_log_thread_ring = NULL;
+static __thread lv2h_t *lv2h_log_thread_host = NULL;
+
+int lv2h_log_start(lv2h_t *host, int level, FILE *file, int rate_limit) {
+    if (host->log_running) {
+        LV2H_RETURN_ERR(host, "lv2h_log_start: already running\n%s", "");
+    }
+    if (level < LV2H_LOG_OFF || level > LV2H_LOG_DEBUG) {
+        LV2H_RETURN_ERR(host, "lv2h_log_start: invalid level %d\n", level);
+    }
+    host->log_file = file ? file : stderr;
+    host->log_rate_limit = rate_limit;
+    host->log_running = 1;
+    if (pthread_create(&host->log_thread, NULL, lv2h_log_run_drain, host) != 0) {
+        host->log_running = 0;
+        LV2H_RETURN_ERR(host, "lv2h_log_start: pthread_create failed\n%s", "");
+    }
+    __atomic_store_n(&host->log_level, level, __ATOMIC_RELEASE);
+    return LV2H_OK;
+}
+
+int lv2h_log_stop(lv2h_t *host) {
+    if (!host->log_running) {
+        return LV2H_OK;
+    }
+    __atomic_store_n(&host->log_level, LV2H_LOG_OFF, __ATOMIC_RELEASE);
+    __atomic_store_n(&host->log_running, 0, __ATOMIC_RELEASE);
+    pthread_join(host->log_thread, NULL);
+    lv2h_log_drain(host);
+    fflush(host->log_file);
+    return LV2H_OK;
+}
+
+int lv2h_log_free(lv2h_t *host) {
+    lv2h_log_ring_t *ring, *ring_tmp;
+    lv2h_log_stop(host);
+    LL_FOREACH_SAFE(host->log_ring_list, ring, ring_tmp) {
+        LL_DELETE(host->log_ring_list, ring);
+        free(ring);
+    }
+    return LV2H_OK;
+}
+
+int lv2h_log_get_stats(lv2h_t *host, unsigned long *out_dropped, unsigned long *out_limited) {
+    *out_dropped = __sync_fetch_and_add(&host->log_dropped, 0);
+    *out_limited = __sync_fetch_and_add(&host->log_limited, 0);
+    return LV2H_OK;
+}
+
+int lv2h_log_register_thread(lv2h_t *host) {
+    return lv2h_log_get_ring(host) ? LV2H_OK : LV2H_ERR;
+}
+
+void lv2h_log(lv2h_t *host, int level, const char *fmt, ...) {
+    lv2h_log_ring_t *ring;
+    lv2h_log_record_t *record;
+    struct timespec ts;
+    unsigned long head;
+    va_list ap;
+    long now_ns;
+
+    if (level > __atomic_load_n(&host->log_level, __ATOMIC_ACQUIRE)) {
+        return;
+    }
+    if (!(ring = lv2h_log_get_ring(host))) {
+        __sync_fetch_and_add(&host->log_dropped, 1);
+        return;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    now_ns = ts.tv_sec * 1000000000L + ts.tv_nsec;
+
+    // Rate limit per thread with a 1 second window
+    if (host->log_rate_limit > 0) {
+        if (now_ns - ring->window_start_ns >= 1000000000L) {
+            ring->window_start_ns = now_ns;
+            ring->window_count = 0;
+        }
+        if (ring->window_count >= host->log_rate_limit) {
+            __sync_fetch_and_add(&host->log_limited, 1);
+            return;
+        }
+        ring->window_count += 1;
+    }
+
+    head = ring->head;
+    if (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) >= LV2H_LOG_RING_SIZE) {
+        __sync_fetch_and_add(&host->log_dropped, 1);
+        return;
+    }
+
+    record = &ring->records[head & (LV2H_LOG_RING_SIZE - 1)];
+    record->ts_ns = now_ns;
+    record->level = level;
+    va_start(ap, fmt);
+    vsnprintf(record->msg, sizeof(record->msg), fmt, ap);
+    va_end(ap);
+
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+static void *lv2h_log_run_drain(void *arg) {
+    lv2h_t *host;
+    struct timespec ts;
+
+    host = (lv2h_t*)arg;
+    ts.tv_sec = 0;
+    ts.tv_nsec = LV2H_LOG_DRAIN_INTERVAL_NS;
+
+    while (__atomic_load_n(&host->log_running, __ATOMIC_ACQUIRE)) {
+        if (lv2h_log_drain(host) > 0) {
+            fflush(host->log_file);
+        }
+        nanosleep(&ts, NULL);
+    }
+    return NULL;
+}
+
+static int lv2h_log_drain(lv2h_t *host) {
+    lv2h_log_ring_t *ring;
+    lv2h_log_record_t *record;
+    unsigned long head, tail;
+    int count;
+
+    count = 0;
+    pthread_mutex_lock(&host->log_mutex);
+    LL_FOREACH(host->log_ring_list, ring) {
+        head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        for (tail = ring->tail; tail != head; ++tail) {
+            record = &ring->records[tail & (LV2H_LOG_RING_SIZE - 1)];
+            fprintf(host->log_file, "[%ld.%06ld] %s: %s",
+                record->ts_ns / 1000000000L,
+                (record->ts_ns % 1000000000L) / 1000L,
+                lv2h_log_level_names[record->level],
+                record->msg);
+            count += 1;
+        }
+        __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&host->log_mutex);
+    return count;
+}
+
+static lv2h_log_ring_t *lv2h_log_get_ring(lv2h_t *host) {
+    lv2h_log_ring_t *ring;
+
+    if (lv2h_log_thread_host == host && lv2h_log_thread_ring) {
+        return lv2h_log_thread_ring;
+    }
+
+    // First message from this thread. Realtime threads register ahead of
+    // time in lv2h_rt_enter_thread so this allocation is off the hot path.
+    if (!(ring = calloc(1, sizeof(lv2h_log_ring_t)))) {
+        return NULL;
+    }
+    pthread_mutex_lock(&host->log_mutex);
+    LL_APPEND(host->log_ring_list, ring);
+    pthread_mutex_unlock(&host->log_mutex);
+
+    lv2h_log_thread_host = host;
+    lv2h_log_thread_ring = ring;
+    return ring;
+}
@@ -45,8 +45,24 @@ lv2_evbuf_new(uint32_t       capacity,
               uint32_t       atom_Sequence)
 {
 	// FIXME: memory must be 64-bit aligned
-	LV2_Evbuf* evbuf = (LV2_Evbuf*)malloc(
-		sizeof(LV2_Evbuf) + sizeof(LV2_Atom_Sequence) + capacity);
+	return lv2_evbuf_init(malloc(lv2_evbuf_size(capacity)),
+	                      capacity, type, atom_Chunk, atom_Sequence);
+}
+
+size_t
+lv2_evbuf_size(uint32_t capacity)
+{
+	return sizeof(LV2_Evbuf) + sizeof(LV2_Atom_Sequence) + capacity;
+}
+
+LV2_Evbuf*
+lv2_evbuf_init(void*          mem,
+               uint32_t       capacity,
+               LV2_Evbuf_Type type,
+               uint32_t       atom_Chunk,
+               uint32_t       atom_Sequence)
+{
+	LV2_Evbuf* evbuf = (LV2_Evbuf*)mem;
 	evbuf->capacity      = capacity;
 	evbuf->atom_Chunk    = atom_Chunk;
 	evbuf->atom_Sequence = atom_Sequence;
@@ -17,6 +17,7 @@
 #ifndef LV2_EVBUF_H
 #define LV2_EVBUF_H
 
+#include <stddef.h>
 #include <stdint.h>
 
 #ifdef __cplusplus
@@ -58,6 +59,24 @@ lv2_evbuf_new(uint32_t       capacity,
               uint32_t       atom_Chunk,
               uint32_t       atom_Sequence);
 
+/**
+   Return the number of bytes an event buffer of `capacity` occupies.
+*/
+size_t
+lv2_evbuf_size(uint32_t capacity);
+
+/**
+   Initialize a new, empty event buffer in caller-owned memory.
+   `mem` must be at least lv2_evbuf_size(capacity) bytes and 8-byte aligned.
+   The result must not be passed to lv2_evbuf_free.
+*/
+LV2_Evbuf*
+lv2_evbuf_init(void*          mem,
+               uint32_t       capacity,
+               LV2_Evbuf_Type type,
+               uint32_t       atom_Chunk,
+               uint32_t       atom_Sequence);
+
 /**
    Free an event buffer allocated with lv2_evbuf_new.
 */
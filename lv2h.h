@@ -10,11 +10,14 @@
 #include <time.h>
 #include <limits.h>
 #include <pthread.h>
+#include <stdarg.h>
 #include <soundio/soundio.h>
+#include <alsa/asoundlib.h>
 #include <lilv-0/lilv/lilv.h>
 #include <lv2/lv2plug.in/ns/ext/atom/atom.h>
 #include <lv2/lv2plug.in/ns/ext/buf-size/buf-size.h>
 #include <lv2/lv2plug.in/ns/ext/midi/midi.h>
+#include <lv2/lv2plug.in/ns/ext/options/options.h>
 #include <uthash.h>
 #include <utlist.h>
 #include "lv2_evbuf.h"
@@ -35,26 +38,230 @@
     return;                                                                 \
 } while (0)
 
+#define LV2H_SILENCE_THRESHOLD 1e-6f // -120 dBFS
+#define LV2H_DEFAULT_TAIL_MS 2000
+
+#define LV2H_THREAD_AUDIO  0
+#define LV2H_THREAD_WORKER 1
+#define LV2H_THREAD_SCHED  2
+#define LV2H_THREAD_MIDI   3
+#define LV2H_THREAD_COUNT  4
+
+#define LV2H_LOG_OFF   -1
+#define LV2H_LOG_ERROR 0
+#define LV2H_LOG_WARN  1
+#define LV2H_LOG_INFO  2
+#define LV2H_LOG_DEBUG 3
+#define LV2H_LOG_RING_SIZE 256 // must be power of 2
+#define LV2H_LOG_MSG_SIZE 240
+#define LV2H_TRACE_RING_SIZE 4096 // must be power of 2
+#define LV2H_MSG_RING_SIZE 4096 // must be power of 2
+#define LV2H_MSG_DATA_SIZE 16
+#define LV2H_SEQUENCE_SIZE 1024 // atom port capacity in bytes
+#define LV2H_ARENA_ALIGN 64 // cache line, and wide enough for any vector load
+#define LV2H_MSG_MIDI  0
+#define LV2H_MSG_PARAM 1
+#define LV2H_BATCH_SIZE 64
+#define LV2H_REC_MAX 8
+#define LV2H_REC_MAX_CHANNELS 16
+#define LV2H_REC_DIRECT 1 // open with O_DIRECT
+#define LV2H_REC_HEADER_INTERVAL_MS 1000
+#define LV2H_PROBE_SLOTS 64 // must be power of 2
+#define LV2H_PROBE_BUCKETS 24
+#define LV2H_PROBE_STAGE_SCHED  0 // node callback due to message submitted
+#define LV2H_PROBE_STAGE_QUEUE  1 // submitted to written into the atom buffer
+#define LV2H_PROBE_STAGE_RUN    2 // written to instance run done
+#define LV2H_PROBE_STAGE_OUTPUT 3 // run done to heard, incl. device latency
+#define LV2H_PROBE_STAGE_TOTAL  4
+#define LV2H_PROBE_STAGE_COUNT  5
+#define LV2H_TRACE_BEGIN(host) ((host)->trace_enabled ? lv2h_trace_now_ns() : 0L)
+#define LV2H_TRACE_END(host, name, arg, begin_ns) do {                       \
+    if (begin_ns) lv2h_trace_span((host), (name), (arg), (begin_ns));       \
+} while (0)
+#define LV2H_LOG(host, level, ...) do {                                     \
+    if ((level) <= (host)->log_level) lv2h_log((host), (level), __VA_ARGS__); \
+} while (0)
+
 typedef struct _lv2h_t lv2h_t;
 typedef struct _lv2h_plug_t lv2h_plug_t;
 typedef struct _lv2h_inst_t lv2h_inst_t;
 typedef struct _lv2h_port_t lv2h_port_t;
 typedef struct _lv2h_node_t lv2h_node_t;
 typedef struct _lv2h_event_t lv2h_event_t;
+typedef struct _lv2h_rt_config_t lv2h_rt_config_t;
+typedef struct _lv2h_rt_result_t lv2h_rt_result_t;
+typedef struct _lv2h_lock_stats_t lv2h_lock_stats_t;
+typedef struct _lv2h_probe_t lv2h_probe_t;
+typedef struct _lv2h_probe_hist_t lv2h_probe_hist_t;
+typedef struct _lv2h_mem_stats_t lv2h_mem_stats_t;
+typedef struct _lv2h_log_record_t lv2h_log_record_t;
+typedef struct _lv2h_log_ring_t lv2h_log_ring_t;
+typedef struct _lv2h_trace_span_t lv2h_trace_span_t;
+typedef struct _lv2h_trace_ring_t lv2h_trace_ring_t;
+typedef struct _lv2h_trace_name_t lv2h_trace_name_t;
 typedef int (*lv2h_node_callback_fn)(lv2h_node_t *node, void *udata, int count);
 typedef int (*lv2h_event_callback_fn)(lv2h_event_t *event);
+typedef struct _lv2h_backend_t lv2h_backend_t;
+typedef struct _lv2h_conn_t lv2h_conn_t;
+typedef struct _lv2h_sched_t lv2h_sched_t;
+typedef struct _lv2h_sched_item_t lv2h_sched_item_t;
+typedef struct _lv2h_sched_edge_t lv2h_sched_edge_t;
+typedef struct _lv2h_latency_line_t lv2h_latency_line_t;
+typedef struct _lv2h_freeze_t lv2h_freeze_t;
+typedef struct _lv2h_pool_t lv2h_pool_t;
+typedef struct _lv2h_preset_t lv2h_preset_t;
+typedef struct _lv2h_msg_t lv2h_msg_t;
+typedef struct _lv2h_batch_t lv2h_batch_t;
+typedef struct _lv2h_midi_t lv2h_midi_t;
+typedef struct _lv2h_midi_route_t lv2h_midi_route_t;
+typedef struct _lv2h_rec_t lv2h_rec_t;
+typedef struct _lv2h_rec_stats_t lv2h_rec_stats_t;
+typedef struct _lv2h_bridge_t lv2h_bridge_t;
+typedef struct _lv2h_bridge_shm_t lv2h_bridge_shm_t;
+typedef struct _lv2h_voice_t lv2h_voice_t;
+typedef struct _lv2h_voice_note_t lv2h_voice_note_t;
+typedef struct _lv2h_pool_note_off_t lv2h_pool_note_off_t;
+typedef int (*lv2h_freeze_callback_fn)(lv2h_inst_t *inst, void *udata, long frame);
+typedef int (*lv2h_backend_run_fn)(lv2h_t *host);
+typedef int (*lv2h_sink_callback_fn)(lv2h_t *host, float *interleaved, int frame_count, int channel_count, void *udata);
 
 // TODO remove unused struct fields
 
+struct _lv2h_rt_config_t {
+    int priority; // SCHED_FIFO priority, 0 = inherit
+    int cpu; // pin to this cpu, -1 = no pinning
+    int denormals_off; // set FTZ/DAZ
+};
+
+struct _lv2h_rt_result_t {
+    int applied;
+    int priority;
+    int cpu;
+    int denormals_off;
+    int sched_err;
+    int affinity_err;
+};
+
+struct _lv2h_lock_stats_t {
+    unsigned long run_skipped; // blocks an instance missed while locked
+    unsigned long contended; // control thread lock waits
+    long wait_ns; // total control thread wait
+    long wait_max_ns;
+};
+
+struct _lv2h_mem_stats_t {
+    size_t arena_bytes; // port structs, buffers and names
+    size_t payload_bytes; // arena_bytes less alignment padding
+    size_t heap_bytes; // instance struct, port index, feedback buffers
+};
+
+struct _lv2h_probe_t {
+    int state;
+    lv2h_inst_t *inst;
+    uint32_t frame;
+    long due_ns; // 0 unless submitted from a node callback
+    long submit_ns;
+    long insert_ns;
+    long run_ns;
+};
+
+struct _lv2h_probe_hist_t {
+    unsigned long count;
+    unsigned long bucket[LV2H_PROBE_BUCKETS]; // log2 of microseconds
+    long sum_ns;
+    long max_ns;
+};
+
+struct _lv2h_log_record_t {
+    long ts_ns;
+    int level;
+    char msg[LV2H_LOG_MSG_SIZE];
+};
+
+struct _lv2h_log_ring_t {
+    lv2h_log_record_t records[LV2H_LOG_RING_SIZE];
+    unsigned long head; // written by owning thread
+    unsigned long tail; // written by drain thread
+    long window_start_ns;
+    int window_count;
+    lv2h_log_ring_t *next;
+};
+
+struct _lv2h_trace_span_t {
+    const char *name;
+    const void *arg;
+    long begin_ns;
+    long end_ns;
+};
+
+struct _lv2h_trace_ring_t {
+    lv2h_trace_span_t spans[LV2H_TRACE_RING_SIZE];
+    unsigned long head;
+    int tid;
+    char thread_name[16];
+    lv2h_trace_ring_t *next;
+};
+
+struct _lv2h_trace_name_t {
+    char *name;
+    UT_hash_handle hh;
+};
+
+struct _lv2h_backend_t {
+    const char *name;
+    lv2h_backend_run_fn run; // returns when host->done is set
+};
+
 struct _lv2h_t {
     lv2h_plug_t *plugin_map;
     lv2h_node_t *parent_node_list;
     lv2h_plug_t *audio_plug;
     lv2h_inst_t *audio_inst;
+    lv2h_plug_t *input_plug;
+    lv2h_inst_t *input_inst;
+    lv2h_pool_t *pool_list;
+    lv2h_midi_t *midi_list;
+    lv2h_bridge_t *bridge_list;
+    lv2h_rec_t *rec_array[LV2H_REC_MAX]; // read by the audio thread
+    lv2h_msg_t *msg_ring;
+    unsigned long msg_seen; // ring position up to which drains have looked
+    unsigned long msg_head;
+    unsigned long msg_tail;
+    unsigned long msg_dropped;
+    int msg_lock; // 0 free, 1 held, 2 held with sleepers
+    LV2_URID urid_midi_event;
+    struct SoundIoRingBuffer *capture_ring;
+    unsigned long capture_overflow_count;
+    unsigned long capture_underflow_count;
+    lv2h_backend_t *backend;
+    lv2h_sched_t *sched;
+    lv2h_sched_t *sched_in_use;
+    lv2h_sched_t *sched_retired_list;
+    pthread_mutex_t graph_mutex;
+    unsigned long graph_gen;
+    int sleep_enabled;
+    int latency_changed; // set by the audio thread, recompiles
+    long output_latency_frames;
+    int prune_deactivate;
+    int group_plugs; // order the schedule to run copies of a plugin together
+    long default_tail_frames;
+    lv2h_sink_callback_fn sink_callback;
+    void *sink_udata;
+    int sink_fd;
+    int sink_realtime;
     lv2h_event_t *event_list;
     int sample_rate;
     long tick_ns;
     int block_size;
+    long block_frame; // first frame of the block being rendered
+    int block_frames;
+    long frame_clock; // frames rendered so far
+    long clock_frame; // frame heard at clock_ns, anchored by the backend
+    long clock_ns; // 0 until the backend anchors the clock
+    long ts_lead_frames; // timestamped input lead
+    long ts_lead_need; // most lead any input needed this window, -1 if none
+    long ts_window_frame; // first frame of the current lead window
+    int out_offset; // frames of the last block already handed to the device
     long ts_now_ns;
     long ts_next_ns;
     float *audio_block_array;
@@ -65,18 +272,52 @@ struct _lv2h_t {
     LilvNode *lv2_core_AudioPort;
     LilvNode *lv2_core_ControlPort;
     LilvNode *lv2_core_CVPort;
+    LilvNode *lv2_core_reportsLatency;
     LilvNode *lv2_atom_AtomPort;
     LilvNode *lv2_atom_Sequence;
     LilvNode *lv2_urid_map;
     LV2_Feature feature_map;
     LV2_Feature feature_unmap;
-    const LV2_Feature *features[3];
+    LV2_Feature feature_options;
+    LV2_Feature feature_bounded_block;
+    LV2_Feature feature_fixed_block;
+    LV2_Feature feature_pow2_block;
+    const LV2_Feature *features[7];
+    LV2_Options_Option options[5];
+    int32_t opt_block_length; // min, max and nominal are all block_size
+    int32_t opt_sequence_size;
     LV2_URID_Map urid_map;
     LV2_URID_Unmap urid_unmap;
     char **lv2_uris;
     size_t lv2_uris_size;
     uintmax_t audio_iter;
-    pthread_mutex_t mutex;
+    lv2h_lock_stats_t lock_stats;
+    int probe_rate; // tag one in this many MIDI messages, 0 for off
+    unsigned long probe_seq;
+    unsigned long probe_lost;
+    int probe_pending; // audio thread only
+    lv2h_probe_t probe_array[LV2H_PROBE_SLOTS];
+    lv2h_probe_hist_t probe_hist_array[LV2H_PROBE_STAGE_COUNT];
+    lv2h_rt_config_t rt_config[LV2H_THREAD_COUNT];
+    lv2h_rt_result_t rt_result[LV2H_THREAD_COUNT];
+    size_t rt_locked_bytes;
+    int rt_mlock_err;
+    lv2h_log_ring_t *log_ring_list;
+    pthread_mutex_t log_mutex;
+    pthread_t log_thread;
+    FILE *log_file;
+    int log_level;
+    int log_rate_limit;
+    int log_running;
+    unsigned long log_dropped;
+    unsigned long log_limited;
+    lv2h_trace_ring_t *trace_ring_list;
+    lv2h_trace_name_t *trace_name_map; // span names, kept until lv2h_free
+    pthread_mutex_t trace_mutex;
+    char *trace_xrun_prefix;
+    int trace_enabled;
+    int trace_xrun_pending;
+    unsigned long xrun_count;
     int done;
     char errstr[1024];
 };
@@ -84,42 +325,286 @@ struct _lv2h_t {
 struct _lv2h_plug_t {
     lv2h_t *host;
     char *uri_str;
+    const char *trace_name; // outlives the plug for trace dumps
     LilvNode *lilv_uri;
     const LilvPlugin *lilv_plugin;
     uint32_t port_count;
     float *port_mins;
     float *port_maxs;
     float *port_defaults;
+    size_t arena_size; // per instance
     lv2h_inst_t *inst_list;
+    lv2h_preset_t *preset_map;
     UT_hash_handle hh;
 };
 
 struct _lv2h_inst_t {
     lv2h_plug_t *plug;
     uintmax_t audio_iter;
+    unsigned long graph_gen;
+    int graph_on_path;
+    size_t graph_index; // position in the schedule being built
+    uint32_t session_index;
+    long tail_frames; // -1 = host default
+    long silent_frames;
+    int has_events;
+    int has_probe; // a tagged event went in this block
+    int wake;
+    int is_sleeping;
+    int is_reachable; // connected to the master bus
+    int is_active;
+    int is_frozen;
+    int is_rendering; // run offline by lv2h_inst_freeze
+    lv2h_freeze_t *freeze; // NULL while rendering
+    lv2h_bridge_t *bridge; // plugin runs in a child process, NULL if in-process
+    lv2h_preset_t *pending_preset; // applied by the audio thread
+    lv2h_port_t *latency_port; // reportsLatency output, NULL if none
+    long latency_frames; // last reported
+    long path_latency; // from the graph inputs through this instance
+    pthread_mutex_t mutex; // held across run; the audio thread only tries it
     LilvInstance *lilv_inst;
+    uint8_t *arena; // one block for everything below, LV2H_ARENA_ALIGN aligned
+    size_t arena_size;
+    size_t arena_low; // buffers are taken from the bottom
+    size_t arena_high; // names from the top
+    size_t arena_payload;
     lv2h_port_t *port_array;
     lv2h_port_t *port_map;
+    lv2h_port_t **port_kind_array; // backs the arrays below, one run per kind
+    lv2h_port_t **audio_in_array;
+    uint32_t audio_in_count;
+    lv2h_port_t **audio_out_array;
+    uint32_t audio_out_count;
+    lv2h_port_t **atom_in_array;
+    uint32_t atom_in_count;
+    lv2h_port_t **control_array;
+    uint32_t control_count;
     lv2h_inst_t *next;
 };
 
 struct _lv2h_port_t {
+    // Touched every block, kept together at the front
     lv2h_inst_t *inst;
+    float *writer_block;
+    float *reader_block_mixed;
+    float *feedback_block; // previous block of writer_block for feedback edges
+    LV2_Evbuf *atom_input; // TODO replace type
+    uint32_t atom_frame; // last event frame written this block
+    float control_val;
+    int is_silent; // block below LV2H_SILENCE_THRESHOLD
+    int is_control;
+
+    // Setup and lookup only
     const LilvPort *lilv_port;
     uint32_t port_index;
     char *port_name;
-    float control_val;
-    int is_control;
-    float *writer_block;
-    float *reader_block_mixed;
     LV2_Atom_Sequence *atom_output;
-    LV2_Evbuf *atom_input; // TODO replace type
     LV2_Evbuf_Iterator atom_input_iter;
-    lv2h_port_t *writer_port_list;
-    lv2h_port_t *next;
+    lv2h_conn_t *conn_list; // connections into this port
+    int was_connected;
+    UT_hash_handle hh;
+};
+
+struct _lv2h_conn_t {
+    lv2h_port_t *writer_port;
+    lv2h_port_t *reader_port;
+    int is_feedback; // set by lv2h_graph_compile
+    lv2h_latency_line_t *latency_line; // compensation on the live schedule
+    lv2h_conn_t *next;
+};
+
+struct _lv2h_sched_edge_t {
+    lv2h_port_t *reader_port;
+    lv2h_port_t *writer_port; // NULL clears reader_block_mixed
+    float *writer_block;
+    int is_first; // copy rather than add
+    lv2h_latency_line_t *latency_line; // NULL = no compensation
+};
+
+struct _lv2h_latency_line_t {
+    float *buffer; // ring of frames samples
+    float *out_block;
+    long frames;
+    long position;
+    long quiet_frames; // silent input since the last loud block
+    int ref_count; // schedules and the conn
+};
+
+struct _lv2h_sched_item_t {
+    lv2h_inst_t *inst;
+    int is_frozen; // play back cached output instead of running
+    size_t edge_start;
+    size_t edge_count;
+};
+
+struct _lv2h_sched_t {
+    lv2h_inst_t *root;
+    lv2h_sched_item_t *item_array; // writers before readers, master bus last
+    size_t item_count;
+    lv2h_sched_edge_t *edge_array;
+    size_t edge_count;
+    lv2h_port_t **delay_port_array; // writers with feedback edges
+    size_t delay_port_count;
+    lv2h_latency_line_t **latency_line_array; // released with the schedule
+    size_t latency_line_count;
+    lv2h_sched_t *next;
+};
+
+struct _lv2h_msg_t {
+    lv2h_port_t *port; // NULL once purged
+    int type;
+    uint32_t frame; // offset into the block
+    long ts_ns; // if set, frame is derived from this at drain time
+    int probe_id; // latency probe slot + 1, 0 if untagged
+    uint32_t size;
+    float val;
+    uint8_t data[LV2H_MSG_DATA_SIZE];
+};
+
+struct _lv2h_batch_t {
+    lv2h_t *host;
+    lv2h_msg_t msgs[LV2H_BATCH_SIZE];
+    int count;
+};
+
+struct _lv2h_midi_route_t {
+    int chan; // -1 = all
+    lv2h_port_t *port;
+    lv2h_midi_route_t *next;
+};
+
+struct _lv2h_midi_t {
+    lv2h_t *host;
+    snd_seq_t *seq;
+    snd_midi_event_t *decoder;
+    int port_id;
+    int queue_id;
+    long clock_offset_ns; // queue real time to CLOCK_MONOTONIC
+    pthread_t thread;
+    pthread_mutex_t mutex; // guards route_list
+    lv2h_midi_route_t *route_list;
+    unsigned long received_count;
+    unsigned long dropped_count;
+    int done;
+    lv2h_midi_t *next;
+};
+
+struct _lv2h_bridge_shm_t {
+    uint32_t req; // bumped by the host per block
+    uint32_t ack; // set to req by the child when done
+    int32_t frame_count;
+    int32_t quit;
+    uint32_t port_count;
+    uint8_t pad[44]; // port offset table starts on the next cache line
+};
+
+struct _lv2h_bridge_t {
+    lv2h_inst_t *inst;
+    lv2h_bridge_shm_t *shm;
+    uint8_t *base; // same mapping as shm
+    size_t map_size;
+    int shm_fd; // memfd backing the map, passed to the helper
+    size_t *port_offset_array; // 0 if the port is not connected
+    lv2h_port_t **audio_in_array;
+    uint32_t audio_in_count;
+    lv2h_port_t **audio_out_array;
+    uint32_t audio_out_count;
+    lv2h_port_t **control_in_array;
+    uint32_t control_in_count;
+    lv2h_port_t **control_out_array;
+    uint32_t control_out_count;
+    pid_t pid;
+    long timeout_ns;
+    long stall_blocks; // consecutive misses before a restart
+    long miss_count;
+    int is_down;
+    unsigned long timeout_count;
+    unsigned long restart_count;
+    lv2h_bridge_t *next;
+};
+
+struct _lv2h_rec_t {
+    lv2h_t *host;
+    lv2h_port_t *port_array[LV2H_REC_MAX_CHANNELS]; // NULL records silence
+    int channel_count;
+    int slot;
+    float *ring; // interleaved, ring_frames frames
+    size_t ring_frames; // power of 2
+    unsigned long head; // written by the audio thread
+    unsigned long tail; // written by the writer thread
+    float *chunk; // aligned write buffer
+    int fd;
+    int is_direct;
+    size_t data_bytes;
+    long header_interval_ns;
+    pthread_t thread;
+    unsigned long frames_written;
+    unsigned long high_water_frames;
+    unsigned long overrun_count;
+    int write_errno;
+    int done;
+};
+
+struct _lv2h_rec_stats_t {
+    unsigned long frames_written;
+    unsigned long ring_frames;
+    unsigned long high_water_frames; // fullest the ring has been
+    unsigned long overrun_count; // blocks dropped with the ring full
+    int write_errno;
+};
+
+struct _lv2h_preset_t {
+    char *uri_str;
+    lv2h_plug_t *plug;
+    uint32_t *port_index_array;
+    float *value_array;
+    uint32_t value_count;
+    LilvState *state; // NULL if the preset is only port values
     UT_hash_handle hh;
 };
 
+struct _lv2h_freeze_t {
+    float *buffer; // mmap, planar, frame_count floats per port
+    size_t map_size;
+    long frame_count;
+    long position;
+    lv2h_port_t **port_array; // output ports with writer blocks
+    uint32_t port_count;
+};
+
+struct _lv2h_voice_note_t {
+    int chan;
+    int note;
+    unsigned long seq;
+    int is_on;
+};
+
+struct _lv2h_voice_t {
+    lv2h_inst_t *inst;
+    lv2h_port_t *midi_port;
+    lv2h_voice_note_t *note_array; // notes_per_voice slots
+    int note_count;
+    unsigned long last_seq;
+};
+
+struct _lv2h_pool_note_off_t {
+    lv2h_pool_t *pool; // NULL once the pool is freed
+    unsigned long seq;
+    lv2h_pool_note_off_t *next;
+};
+
+struct _lv2h_pool_t {
+    lv2h_t *host;
+    lv2h_plug_t *plug;
+    lv2h_voice_t *voice_array;
+    int voice_count;
+    int notes_per_voice;
+    unsigned long note_seq;
+    unsigned long steal_count;
+    lv2h_pool_note_off_t *note_off_list; // scheduled by lv2h_pool_play
+    lv2h_pool_t *next;
+};
+
 struct _lv2h_node_t {
     lv2h_t *host;
     lv2h_node_callback_fn callback;
@@ -152,6 +637,39 @@ LV2H_API int lv2h_new(uint32_t sample_rate, size_t block_size, long tick_ms, lv2
 LV2H_API int lv2h_free(lv2h_t *host);
 LV2H_API int lv2h_run(lv2h_t *host);
 
+LV2H_API int lv2h_set_backend(lv2h_t *host, char *name);
+LV2H_API int lv2h_set_sink(lv2h_t *host, lv2h_sink_callback_fn callback, void *udata, int fd, int realtime);
+LV2H_API int lv2h_set_prune(lv2h_t *host, int deactivate);
+LV2H_API int lv2h_set_group_plugs(lv2h_t *host, int enabled);
+// Off by default. When on, an instance stops running once its inputs and
+// output have been silent for its tail with no events, and wakes on input.
+// Plugins that make sound on their own (sequencers, arpeggiators,
+// metronomes) never wake, so only enable this for graphs without them.
+LV2H_API int lv2h_set_sleep(lv2h_t *host, int enabled, long default_tail_ms);
+LV2H_API int lv2h_set_audio_input(lv2h_t *host, int channel_count);
+LV2H_API int lv2h_set_rt_config(lv2h_t *host, int thread_role, int priority, int cpu, int denormals_off);
+LV2H_API int lv2h_get_rt_result(lv2h_t *host, int thread_role, lv2h_rt_result_t *out_result);
+LV2H_API int lv2h_lock_memory(lv2h_t *host, size_t prefault_bytes);
+LV2H_API int lv2h_get_output_latency(lv2h_t *host, long *out_frames);
+LV2H_API int lv2h_get_lock_stats(lv2h_t *host, lv2h_lock_stats_t *out_stats);
+LV2H_API int lv2h_get_capture_stats(lv2h_t *host, unsigned long *out_overflows, unsigned long *out_underflows);
+LV2H_API int lv2h_inst_get_mem_stats(lv2h_inst_t *inst, lv2h_mem_stats_t *out_stats);
+LV2H_API int lv2h_mem_report(lv2h_t *host, FILE *fp);
+
+LV2H_API int lv2h_log_start(lv2h_t *host, int level, FILE *file, int rate_limit);
+LV2H_API int lv2h_log_stop(lv2h_t *host);
+LV2H_API int lv2h_log_get_stats(lv2h_t *host, unsigned long *out_dropped, unsigned long *out_limited);
+LV2H_API void lv2h_log(lv2h_t *host, int level, const char *fmt, ...) __attribute__((format(printf, 3, 4)));
+
+LV2H_API int lv2h_probe_set_rate(lv2h_t *host, int every_n);
+LV2H_API int lv2h_probe_get_hist(lv2h_t *host, int stage, lv2h_probe_hist_t *out_hist);
+LV2H_API int lv2h_probe_reset(lv2h_t *host);
+LV2H_API int lv2h_probe_report(lv2h_t *host, FILE *fp);
+LV2H_API int lv2h_trace_start(lv2h_t *host);
+LV2H_API int lv2h_trace_stop(lv2h_t *host);
+LV2H_API int lv2h_trace_dump(lv2h_t *host, char *path);
+LV2H_API int lv2h_trace_dump_on_xrun(lv2h_t *host, char *path_prefix);
+
 LV2H_API int lv2h_plug_new(lv2h_t *host, char *uri_str, lv2h_plug_t **out_plug);
 LV2H_API int lv2h_plug_free(lv2h_plug_t *plugin);
 
@@ -165,9 +683,52 @@ LV2H_API int lv2h_inst_send_midi(lv2h_inst_t *inst, char *port_name, uint8_t *by
 LV2H_API int lv2h_inst_set_param(lv2h_inst_t *inst, char *port_name, float val);
 LV2H_API int lv2h_inst_play(lv2h_inst_t *inst, char *port_name, int chan, int note1, int note2, int note3, int note4, int vel, int len_ms);
 LV2H_API int lv2h_inst_load_preset(lv2h_inst_t *inst, char *preset_str);
+LV2H_API int lv2h_inst_apply_preset(lv2h_inst_t *inst, lv2h_preset_t *preset);
+LV2H_API int lv2h_preset_get(lv2h_plug_t *plug, char *preset_str, lv2h_preset_t **out_preset);
+LV2H_API int lv2h_inst_get_midi_input_port(lv2h_inst_t *inst, char *port_name, lv2h_port_t **out_port);
+LV2H_API int lv2h_inst_get_control_port(lv2h_inst_t *inst, char *port_name, lv2h_port_t **out_port);
+LV2H_API int lv2h_port_send_midi(lv2h_port_t *port, uint8_t *bytes, int bytes_len);
+LV2H_API int lv2h_port_set_param(lv2h_port_t *port, float val);
+LV2H_API int lv2h_port_play(lv2h_port_t *port, int chan, int note1, int note2, int note3, int note4, int vel, int len_ms);
+LV2H_API int lv2h_batch_begin(lv2h_t *host, lv2h_batch_t *batch);
+LV2H_API int lv2h_batch_midi(lv2h_batch_t *batch, lv2h_port_t *port, uint32_t frame, uint8_t *bytes, int bytes_len);
+LV2H_API int lv2h_batch_param(lv2h_batch_t *batch, lv2h_port_t *port, float val);
+LV2H_API int lv2h_batch_commit(lv2h_batch_t *batch);
+LV2H_API int lv2h_midi_new(lv2h_t *host, char *client_name, lv2h_midi_t **out_midi);
+LV2H_API int lv2h_midi_free(lv2h_midi_t *midi);
+LV2H_API int lv2h_midi_connect(lv2h_midi_t *midi, char *addr_str);
+LV2H_API int lv2h_midi_route(lv2h_midi_t *midi, int chan, lv2h_port_t *port);
+LV2H_API int lv2h_midi_unroute(lv2h_midi_t *midi, int chan, lv2h_port_t *port);
+LV2H_API int lv2h_midi_get_stats(lv2h_midi_t *midi, unsigned long *out_received, unsigned long *out_dropped);
+LV2H_API int lv2h_rec_new(lv2h_t *host, char *path, lv2h_port_t **port_array, int port_count, int flags, lv2h_rec_t **out_rec);
+LV2H_API int lv2h_rec_free(lv2h_rec_t *rec);
+LV2H_API int lv2h_rec_get_stats(lv2h_rec_t *rec, lv2h_rec_stats_t *out_stats);
+LV2H_API int lv2h_inst_new_bridged(lv2h_plug_t *plug, long timeout_us, lv2h_inst_t **out_inst);
+LV2H_API int lv2h_inst_get_bridge_stats(lv2h_inst_t *inst, unsigned long *out_timeouts, unsigned long *out_restarts);
+// Runs the plugin and exits if this process was spawned as a bridge helper,
+// otherwise returns LV2H_OK. Helpers are re-execs of /proc/self/exe, so
+// any program using lv2h_inst_new_bridged must call this first thing in
+// main(), before doing anything else, or each helper runs the whole app.
+LV2H_API int lv2h_bridge_main(int argc, char **argv);
+LV2H_API int lv2h_inst_set_tail(lv2h_inst_t *inst, long tail_ms);
+LV2H_API int lv2h_inst_freeze(lv2h_inst_t *inst, long len_ms, lv2h_freeze_callback_fn callback, void *udata);
+LV2H_API int lv2h_inst_unfreeze(lv2h_inst_t *inst);
+
+LV2H_API int lv2h_session_save(lv2h_t *host, char *path);
+LV2H_API int lv2h_session_load(lv2h_t *host, char *path, lv2h_node_t ***out_node_array, uint32_t *out_node_count);
+
+LV2H_API int lv2h_pool_new(lv2h_plug_t *plug, int voice_count, int notes_per_voice, char *midi_port_name, lv2h_pool_t **out_pool);
+LV2H_API int lv2h_pool_free(lv2h_pool_t *pool);
+LV2H_API int lv2h_pool_connect(lv2h_pool_t *pool, char *writer_port_name, lv2h_inst_t *reader_inst, char *reader_port_name);
+LV2H_API int lv2h_pool_connect_to_audio(lv2h_pool_t *pool, char *writer_port_name, int audio_channel);
+LV2H_API int lv2h_pool_set_param(lv2h_pool_t *pool, char *port_name, float val);
+LV2H_API int lv2h_pool_note_on(lv2h_pool_t *pool, int chan, int note, int vel, unsigned long *out_seq);
+LV2H_API int lv2h_pool_note_off(lv2h_pool_t *pool, int chan, int note);
+LV2H_API int lv2h_pool_play(lv2h_pool_t *pool, int chan, int note1, int note2, int note3, int note4, int vel, int len_ms);
 
 LV2H_API int lv2h_node_new(lv2h_t *host, lv2h_node_callback_fn callback, void *udata, lv2h_node_t **out_node);
 LV2H_API int lv2h_node_free(lv2h_node_t *node);
+LV2H_API int lv2h_node_set_callback(lv2h_node_t *node, lv2h_node_callback_fn callback, void *udata);
 LV2H_API int lv2h_node_set_offset(lv2h_node_t *node, long offset_ms);
 LV2H_API int lv2h_node_set_interval(lv2h_node_t *node, long interval_ms);
 LV2H_API int lv2h_node_set_interval_factor(lv2h_node_t *node, double factor);
@@ -180,6 +741,65 @@ LV2H_API int lv2h_node_unfollow(lv2h_node_t *node);
 
 int lv2h_schedule_event(lv2h_t *host, long timestamp_ns, int audio_run_delay, lv2h_event_callback_fn callback, void *udata);
 int lv2h_run_plugin_insts(lv2h_t *host, int frame_count);
+int lv2h_graph_compile(lv2h_t *host);
+int lv2h_graph_sync(lv2h_t *host);
+int lv2h_graph_free(lv2h_t *host);
+lv2h_sched_t *lv2h_graph_build(lv2h_t *host, lv2h_inst_t *root);
+int lv2h_run_sched(lv2h_t *host, lv2h_sched_t *sched, int frame_count);
+void lv2h_sched_free(lv2h_sched_t *sched);
+int lv2h_inst_init(lv2h_plug_t *plug, LilvInstance *lilv_inst, lv2h_inst_t **out_inst);
+int lv2h_inst_lock(lv2h_inst_t *inst);
+int lv2h_inst_unlock(lv2h_inst_t *inst);
+int lv2h_port_xnnect(lv2h_port_t *writer_port, lv2h_port_t *reader_port, int disconnect, int compile);
+void lv2h_latency_update(lv2h_inst_t *inst);
+int lv2h_latency_check(lv2h_t *host);
+lv2h_latency_line_t *lv2h_latency_line_get(lv2h_sched_t *sched, lv2h_conn_t *conn, long frames, int is_live);
+void lv2h_latency_line_release(lv2h_latency_line_t *line);
+int lv2h_latency_line_run(lv2h_latency_line_t *line, float *in_block, int frame_count);
+int lv2h_freeze_play(lv2h_inst_t *inst, int frame_count);
+int lv2h_freeze_owns(lv2h_inst_t *inst);
+int lv2h_freeze_free(lv2h_inst_t *inst);
+int lv2h_msg_push(lv2h_t *host, lv2h_port_t *port, int type, uint8_t *bytes, int bytes_len, float val);
+int lv2h_msg_drain(lv2h_t *host);
+long lv2h_msg_ts_offset(lv2h_t *host, long ts_ns, int is_new);
+int lv2h_msg_purge_inst(lv2h_inst_t *inst);
+int lv2h_midi_purge_inst(lv2h_inst_t *inst);
+void lv2h_rec_tap(lv2h_t *host, int frame_count);
+int lv2h_rec_purge_inst(lv2h_inst_t *inst);
+int lv2h_bridge_run(lv2h_inst_t *inst, int frame_count);
+int lv2h_bridge_check(lv2h_t *host);
+int lv2h_bridge_free(lv2h_inst_t *inst);
+int lv2h_preset_apply_ports(lv2h_inst_t *inst, lv2h_preset_t *preset);
+int lv2h_preset_free_all(lv2h_plug_t *plug);
+int lv2h_rt_enter_thread(lv2h_t *host, int thread_role);
+int lv2h_log_register_thread(lv2h_t *host);
+int lv2h_log_free(lv2h_t *host);
+int lv2h_trace_register_thread(lv2h_t *host, const char *thread_name);
+int lv2h_trace_check_xrun(lv2h_t *host);
+int lv2h_trace_free(lv2h_t *host);
+const char *lv2h_trace_intern(lv2h_t *host, const char *name);
+long lv2h_trace_now_ns(void);
+void lv2h_probe_set_due(long due_ns);
+int lv2h_probe_tag(lv2h_t *host);
+void lv2h_probe_drop(lv2h_t *host, int probe_id);
+void lv2h_probe_insert(lv2h_t *host, int probe_id, lv2h_inst_t *inst, uint32_t frame);
+void lv2h_probe_run(lv2h_t *host, lv2h_inst_t *inst);
+void lv2h_probe_output(lv2h_t *host, long device_latency_ns);
+void lv2h_trace_span(lv2h_t *host, const char *name, const void *arg, long begin_ns);
+
+#ifdef LV2H_RTCHECK
+LV2H_API unsigned long lv2h_rtcheck_violations(void);
+void lv2h_rtcheck_register_thread(void);
+void lv2h_rtcheck_block_begin(void);
+void lv2h_rtcheck_block_end(void);
+#else
+#define lv2h_rtcheck_violations() 0UL
+#define lv2h_rtcheck_register_thread()
+#define lv2h_rtcheck_block_begin()
+#define lv2h_rtcheck_block_end()
+#endif
 void *lv2h_run_audio(void *arg);
+int lv2h_process_block(lv2h_t *host, int frame_count);
+int lv2h_soundio_run(lv2h_t *host);
 
 #endif
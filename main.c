@@ -14,8 +14,8 @@ int main(int argc, char **argv) {
     lv2h_node_t *node[2];
     int rv;
 
-    (void)argc;
-    (void)argv;
+    // Bridged plugins run in a copy of this binary
+    lv2h_bridge_main(argc, argv);
 
     lv2h_new(44100, 128, 10, &host);
 
@@ -97,9 +97,14 @@ static int lv2h_node_callback0(lv2h_node_t *node, void *udata, int count) {
 
 static int lv2h_node_callback1(lv2h_node_t *node, void *udata, int count) {
     //printf("1count=%d\n", count);
+    static lv2h_port_t *port = NULL;
+    lv2h_batch_t batch;
     uint8_t note, reg, val;
     uint8_t sysex[8] = { 0xf0, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xf7 };
 
+    if (!port) lv2h_inst_get_midi_input_port(inst[0], "lv2_events_in", &port);
+    lv2h_batch_begin(inst[0]->plug->host, &batch);
+
     note = (count*11 + 0x30) % 0x7f;
 
     reg = 0xA0;
@@ -108,7 +113,7 @@ static int lv2h_node_callback1(lv2h_node_t *node, void *udata, int count) {
     sysex[4] = reg & 0x7F;
     sysex[5] = val >> 7;
     sysex[6] = val & 0x7F;
-    lv2h_inst_send_midi(inst[0], "lv2_events_in", sysex, 8);
+    lv2h_batch_midi(&batch, port, 0, sysex, 8);
 
     reg = 0xB0;
     val = 0x20 + (count % 0x1F);
@@ -116,7 +121,10 @@ static int lv2h_node_callback1(lv2h_node_t *node, void *udata, int count) {
     sysex[4] = reg & 0x7F;
     sysex[5] = val >> 7;
     sysex[6] = val & 0x7F;
-    lv2h_inst_send_midi(inst[0], "lv2_events_in", sysex, 8);
+    lv2h_batch_midi(&batch, port, 0, sysex, 8);
+
+    // Both register writes land in the same block
+    lv2h_batch_commit(&batch);
 
     return 0;
 }
@@ -0,0 +1,271 @@
+#include "lv2h.h"
+#include <errno.h>
+#include <poll.h>
+
+static void *lv2h_midi_run(void *arg);
+static int lv2h_midi_read(lv2h_midi_t *midi);
+static int lv2h_midi_dispatch(lv2h_midi_t *midi, lv2h_batch_t *batch, snd_seq_event_t *ev, long now_ns);
+static int lv2h_midi_sync_clock(lv2h_midi_t *midi, long now_ns);
+
+int lv2h_midi_new(lv2h_t *host, char *client_name, lv2h_midi_t **out_midi) {
+    lv2h_midi_t *midi;
+    snd_seq_port_info_t *port_info;
+    int err;
+
+    midi = calloc(1, sizeof(lv2h_midi_t));
+    midi->host = host;
+    midi->queue_id = -1;
+    pthread_mutex_init(&midi->mutex, NULL);
+
+    if ((err = snd_seq_open(&midi->seq, "default", SND_SEQ_OPEN_DUPLEX, SND_SEQ_NONBLOCK)) < 0) {
+        midi->seq = NULL;
+        lv2h_midi_free(midi);
+        LV2H_RETURN_ERR(host, "lv2h_midi_new: snd_seq_open: %s\n", snd_strerror(err));
+    }
+    snd_seq_set_client_name(midi->seq, client_name);
+
+    // The kernel stamps each event with queue real time on arrival, which
+    // is mapped onto the sample clock later rather than trusting when this
+    // thread happens to wake up
+    if ((midi->queue_id = snd_seq_alloc_queue(midi->seq)) < 0) {
+        err = midi->queue_id;
+        lv2h_midi_free(midi);
+        LV2H_RETURN_ERR(host, "lv2h_midi_new: snd_seq_alloc_queue: %s\n", snd_strerror(err));
+    }
+
+    snd_seq_port_info_malloc(&port_info);
+    snd_seq_port_info_set_name(port_info, client_name);
+    snd_seq_port_info_set_capability(port_info, SND_SEQ_PORT_CAP_WRITE | SND_SEQ_PORT_CAP_SUBS_WRITE);
+    snd_seq_port_info_set_type(port_info, SND_SEQ_PORT_TYPE_MIDI_GENERIC | SND_SEQ_PORT_TYPE_APPLICATION);
+    snd_seq_port_info_set_timestamping(port_info, 1);
+    snd_seq_port_info_set_timestamp_real(port_info, 1);
+    snd_seq_port_info_set_timestamp_queue(port_info, midi->queue_id);
+    err = snd_seq_create_port(midi->seq, port_info);
+    midi->port_id = snd_seq_port_info_get_port(port_info);
+    snd_seq_port_info_free(port_info);
+    if (err < 0) {
+        lv2h_midi_free(midi);
+        LV2H_RETURN_ERR(host, "lv2h_midi_new: snd_seq_create_port: %s\n", snd_strerror(err));
+    }
+
+    snd_seq_start_queue(midi->seq, midi->queue_id, NULL);
+    snd_seq_drain_output(midi->seq);
+
+    if ((err = snd_midi_event_new(LV2H_MSG_DATA_SIZE, &midi->decoder)) < 0) {
+        midi->decoder = NULL;
+        lv2h_midi_free(midi);
+        LV2H_RETURN_ERR(host, "lv2h_midi_new: snd_midi_event_new: %s\n", snd_strerror(err));
+    }
+    snd_midi_event_no_status(midi->decoder, 1);
+
+    lv2h_midi_sync_clock(midi, lv2h_trace_now_ns());
+
+    LL_APPEND(host->midi_list, midi);
+    pthread_create(&midi->thread, NULL, lv2h_midi_run, midi);
+
+    *out_midi = midi;
+    return LV2H_OK;
+}
+
+int lv2h_midi_free(lv2h_midi_t *midi) {
+    lv2h_midi_route_t *route, *route_tmp;
+
+    if (midi->thread) {
+        __atomic_store_n(&midi->done, 1, __ATOMIC_RELEASE);
+        pthread_join(midi->thread, NULL);
+        LL_DELETE(midi->host->midi_list, midi);
+    }
+
+    if (midi->decoder) snd_midi_event_free(midi->decoder);
+    if (midi->seq) {
+        if (midi->queue_id >= 0) snd_seq_free_queue(midi->seq, midi->queue_id);
+        snd_seq_close(midi->seq);
+    }
+
+    LL_FOREACH_SAFE(midi->route_list, route, route_tmp) {
+        LL_DELETE(midi->route_list, route);
+        free(route);
+    }
+    pthread_mutex_destroy(&midi->mutex);
+    free(midi);
+    return LV2H_OK;
+}
+
+int lv2h_midi_connect(lv2h_midi_t *midi, char *addr_str) {
+    snd_seq_addr_t addr;
+    int err;
+
+    // Accepts "client:port" or a client name, e.g. a virtual keyboard
+    if ((err = snd_seq_parse_address(midi->seq, &addr, addr_str)) < 0) {
+        LV2H_RETURN_ERR(midi->host, "lv2h_midi_connect: %s: %s\n", addr_str, snd_strerror(err));
+    }
+    if ((err = snd_seq_connect_from(midi->seq, midi->port_id, addr.client, addr.port)) < 0) {
+        LV2H_RETURN_ERR(midi->host, "lv2h_midi_connect: %s: %s\n", addr_str, snd_strerror(err));
+    }
+    return LV2H_OK;
+}
+
+int lv2h_midi_route(lv2h_midi_t *midi, int chan, lv2h_port_t *port) {
+    lv2h_midi_route_t *route;
+
+    if (chan < -1 || chan > 0x0f) {
+        LV2H_RETURN_ERR(midi->host, "lv2h_midi_route: invalid channel %d\n", chan);
+    }
+    if (!port->atom_input) {
+        LV2H_RETURN_ERR(midi->host, "lv2h_midi_route: %s is not a MIDI input\n", port->port_name);
+    }
+
+    route = calloc(1, sizeof(lv2h_midi_route_t));
+    route->chan = chan;
+    route->port = port;
+    pthread_mutex_lock(&midi->mutex);
+    LL_APPEND(midi->route_list, route);
+    pthread_mutex_unlock(&midi->mutex);
+    return LV2H_OK;
+}
+
+int lv2h_midi_unroute(lv2h_midi_t *midi, int chan, lv2h_port_t *port) {
+    lv2h_midi_route_t *route, *route_tmp;
+
+    pthread_mutex_lock(&midi->mutex);
+    LL_FOREACH_SAFE(midi->route_list, route, route_tmp) {
+        if (route->chan == chan && route->port == port) {
+            LL_DELETE(midi->route_list, route);
+            free(route);
+        }
+    }
+    pthread_mutex_unlock(&midi->mutex);
+    return LV2H_OK;
+}
+
+int lv2h_midi_get_stats(lv2h_midi_t *midi, unsigned long *out_received, unsigned long *out_dropped) {
+    if (out_received) *out_received = __atomic_load_n(&midi->received_count, __ATOMIC_RELAXED);
+    if (out_dropped) *out_dropped = __atomic_load_n(&midi->dropped_count, __ATOMIC_RELAXED);
+    return LV2H_OK;
+}
+
+int lv2h_midi_purge_inst(lv2h_inst_t *inst) {
+    lv2h_midi_t *midi;
+    lv2h_midi_route_t *route, *route_tmp;
+
+    // Once this returns the input threads push nothing more for the
+    // instance, so lv2h_msg_purge_inst can clear what is already queued
+    LL_FOREACH(inst->plug->host->midi_list, midi) {
+        pthread_mutex_lock(&midi->mutex);
+        LL_FOREACH_SAFE(midi->route_list, route, route_tmp) {
+            if (route->port->inst == inst) {
+                LL_DELETE(midi->route_list, route);
+                free(route);
+            }
+        }
+        pthread_mutex_unlock(&midi->mutex);
+    }
+    return LV2H_OK;
+}
+
+static void *lv2h_midi_run(void *arg) {
+    lv2h_midi_t *midi;
+    struct pollfd *pfds;
+    int pfd_count;
+
+    midi = (lv2h_midi_t*)arg;
+    lv2h_rt_enter_thread(midi->host, LV2H_THREAD_MIDI);
+
+    pfd_count = snd_seq_poll_descriptors_count(midi->seq, POLLIN);
+    pfds = calloc(pfd_count, sizeof(struct pollfd));
+    snd_seq_poll_descriptors(midi->seq, pfds, pfd_count, POLLIN);
+
+    // Wake up periodically to notice lv2h_midi_free
+    while (!__atomic_load_n(&midi->done, __ATOMIC_ACQUIRE)) {
+        if (poll(pfds, pfd_count, 100) > 0) {
+            lv2h_midi_read(midi);
+        }
+    }
+
+    free(pfds);
+    return NULL;
+}
+
+static int lv2h_midi_read(lv2h_midi_t *midi) {
+    lv2h_batch_t batch;
+    snd_seq_event_t *ev;
+    long now_ns;
+    int count;
+    int rv;
+
+    now_ns = lv2h_trace_now_ns();
+    lv2h_midi_sync_clock(midi, now_ns);
+
+    // Everything read in one wakeup goes to the message queue together.
+    // The lock keeps routes from being purged mid-batch.
+    pthread_mutex_lock(&midi->mutex);
+    lv2h_batch_begin(midi->host, &batch);
+    while ((rv = snd_seq_event_input(midi->seq, &ev)) >= 0 || rv == -ENOSPC) {
+        if (rv == -ENOSPC) {
+            // Kernel input pool overran
+            __sync_fetch_and_add(&midi->dropped_count, 1);
+            continue;
+        }
+        lv2h_midi_dispatch(midi, &batch, ev, now_ns);
+    }
+    count = batch.count;
+    if (count > 0 && lv2h_batch_commit(&batch) != LV2H_OK) {
+        __sync_fetch_and_add(&midi->dropped_count, count);
+    }
+    pthread_mutex_unlock(&midi->mutex);
+    return LV2H_OK;
+}
+
+static int lv2h_midi_dispatch(lv2h_midi_t *midi, lv2h_batch_t *batch, snd_seq_event_t *ev, long now_ns) {
+    lv2h_midi_route_t *route;
+    uint8_t bytes[LV2H_MSG_DATA_SIZE];
+    long len;
+    long ts_ns;
+    int chan;
+
+    if ((len = snd_midi_event_decode(midi->decoder, bytes, sizeof(bytes), ev)) < 0) {
+        if (len == -ENOMEM) {
+            // Longer than a message record, e.g. a large sysex
+            snd_midi_event_reset_decode(midi->decoder);
+            __sync_fetch_and_add(&midi->dropped_count, 1);
+        }
+        return LV2H_OK; // not MIDI, e.g. a subscription announcement
+    }
+    if (len == 0) {
+        return LV2H_OK;
+    }
+    __sync_fetch_and_add(&midi->received_count, 1);
+
+    if ((ev->flags & SND_SEQ_TIME_STAMP_MASK) == SND_SEQ_TIME_STAMP_REAL) {
+        ts_ns = (long)ev->time.time.tv_sec * 1000000000L + ev->time.time.tv_nsec + midi->clock_offset_ns;
+    } else {
+        ts_ns = now_ns;
+    }
+
+    chan = bytes[0] < 0xf0 ? (bytes[0] & 0x0f) : -1;
+    LL_FOREACH(midi->route_list, route) {
+        if (route->chan >= 0 && route->chan != chan) continue;
+        if (batch->count >= LV2H_BATCH_SIZE && lv2h_batch_commit(batch) != LV2H_OK) {
+            __sync_fetch_and_add(&midi->dropped_count, LV2H_BATCH_SIZE);
+        }
+        if (lv2h_batch_midi(batch, route->port, 0, bytes, (int)len) == LV2H_OK) {
+            batch->msgs[batch->count - 1].ts_ns = ts_ns;
+        }
+    }
+    return LV2H_OK;
+}
+
+static int lv2h_midi_sync_clock(lv2h_midi_t *midi, long now_ns) {
+    snd_seq_queue_status_t *status;
+    const snd_seq_real_time_t *rt;
+
+    // Re-measured every wakeup so drift between the queue timer and
+    // CLOCK_MONOTONIC does not accumulate
+    snd_seq_queue_status_malloc(&status);
+    if (snd_seq_get_queue_status(midi->seq, midi->queue_id, status) >= 0) {
+        rt = snd_seq_queue_status_get_real_time(status);
+        midi->clock_offset_ns = now_ns - ((long)rt->tv_sec * 1000000000L + rt->tv_nsec);
+    }
+    snd_seq_queue_status_free(status);
+    return LV2H_OK;
+}
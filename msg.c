@@ -0,0 +1,292 @@
+#include "lv2h.h"
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+#define LV2H_MSG_SPIN 1000
+#define LV2H_MSG_MAX_LEAD_MS 200
+#define LV2H_MSG_LEAD_WINDOW_MS 1000
+
+static int lv2h_msg_push_array(lv2h_t *host, lv2h_msg_t *msgs, int count);
+static int lv2h_msg_fill(lv2h_t *host, lv2h_msg_t *msg, lv2h_port_t *port, int type, uint32_t frame, uint8_t *bytes, int bytes_len, float val);
+static void lv2h_msg_apply(lv2h_t *host, lv2h_msg_t *msg, lv2h_port_t *port, uint32_t frame);
+static void lv2h_msg_sort(lv2h_msg_t *msgs, int count);
+static void lv2h_msg_lock(lv2h_t *host);
+static void lv2h_msg_unlock(lv2h_t *host);
+
+int lv2h_msg_push(lv2h_t *host, lv2h_port_t *port, int type, uint8_t *bytes, int bytes_len, float val) {
+    lv2h_msg_t msg;
+    if (lv2h_msg_fill(host, &msg, port, type, 0, bytes, bytes_len, val) != LV2H_OK) {
+        return LV2H_ERR;
+    }
+    return lv2h_msg_push_array(host, &msg, 1);
+}
+
+int lv2h_batch_begin(lv2h_t *host, lv2h_batch_t *batch) {
+    batch->host = host;
+    batch->count = 0;
+    return LV2H_OK;
+}
+
+int lv2h_batch_midi(lv2h_batch_t *batch, lv2h_port_t *port, uint32_t frame, uint8_t *bytes, int bytes_len) {
+    if (batch->count >= LV2H_BATCH_SIZE) {
+        LV2H_RETURN_ERR(batch->host, "lv2h_batch_midi: batch full\n%s", "");
+    }
+    if (lv2h_msg_fill(batch->host, batch->msgs + batch->count, port, LV2H_MSG_MIDI, frame, bytes, bytes_len, 0.f) != LV2H_OK) {
+        return LV2H_ERR;
+    }
+    batch->count += 1;
+    return LV2H_OK;
+}
+
+int lv2h_batch_param(lv2h_batch_t *batch, lv2h_port_t *port, float val) {
+    if (batch->count >= LV2H_BATCH_SIZE) {
+        LV2H_RETURN_ERR(batch->host, "lv2h_batch_param: batch full\n%s", "");
+    }
+    if (lv2h_msg_fill(batch->host, batch->msgs + batch->count, port, LV2H_MSG_PARAM, 0, NULL, 0, val) != LV2H_OK) {
+        return LV2H_ERR;
+    }
+    batch->count += 1;
+    return LV2H_OK;
+}
+
+int lv2h_batch_commit(lv2h_batch_t *batch) {
+    int rv;
+    // Event buffers want events in time order
+    lv2h_msg_sort(batch->msgs, batch->count);
+    rv = lv2h_msg_push_array(batch->host, batch->msgs, batch->count);
+    batch->count = 0;
+    return rv;
+}
+
+int lv2h_msg_drain(lv2h_t *host) {
+    lv2h_msg_t *msg;
+    lv2h_port_t *port;
+    unsigned long head, tail, pos;
+    long offset;
+    uint32_t frame;
+
+    // The lead falls back to what the last window of input needed, so a
+    // single late wakeup costs latency only until it ages out
+    if (host->block_frame - host->ts_window_frame >= (LV2H_MSG_LEAD_WINDOW_MS * (long)host->sample_rate) / 1000L) {
+        if (host->ts_lead_need >= 0 && host->ts_lead_need < host->ts_lead_frames) {
+            host->ts_lead_frames = host->ts_lead_need;
+        }
+        host->ts_lead_need = -1;
+        host->ts_window_frame = host->block_frame;
+    }
+
+    // Runs on the audio thread at the start of a block. The port is read
+    // once since a purge may blank it at any point.
+    head = __atomic_load_n(&host->msg_head, __ATOMIC_ACQUIRE);
+    tail = host->msg_tail;
+    for (pos = tail; pos != head; ++pos) {
+        msg = &host->msg_ring[pos & (LV2H_MSG_RING_SIZE - 1)];
+        port = __atomic_load_n(&msg->port, __ATOMIC_ACQUIRE);
+        if (port && !__atomic_load_n(&port->inst->is_rendering, __ATOMIC_ACQUIRE)) {
+            frame = msg->frame;
+            if (msg->ts_ns && host->clock_ns) {
+                offset = lv2h_msg_ts_offset(host, msg->ts_ns, (long)(pos - host->msg_seen) >= 0);
+                if (offset >= host->block_frames) {
+                    continue; // due in a later block, kept in the ring
+                }
+                frame = (uint32_t)offset;
+            }
+            lv2h_msg_apply(host, msg, port, frame);
+        } else if (msg->probe_id) {
+            // Purged, or queued just before a freeze took the instance
+            lv2h_probe_drop(host, msg->probe_id);
+        }
+
+        // Done with. The tail stops at the first kept message, and those
+        // behind it are blanked like a purge so later drains skip them.
+        if (pos == tail) {
+            tail += 1;
+        } else {
+            msg->probe_id = 0;
+            __atomic_store_n(&msg->port, NULL, __ATOMIC_RELEASE);
+        }
+    }
+    host->msg_seen = head;
+    __atomic_store_n(&host->msg_tail, tail, __ATOMIC_RELEASE);
+    return LV2H_OK;
+}
+
+int lv2h_msg_purge_inst(lv2h_inst_t *inst) {
+    lv2h_t *host;
+    lv2h_msg_t *msg;
+    unsigned long head, tail;
+
+    // Blank out pending messages for an instance that is going away. A
+    // drain already past this point finishes before the next graph sync
+    // returns.
+    host = inst->plug->host;
+    lv2h_msg_lock(host);
+    head = host->msg_head;
+    for (tail = __atomic_load_n(&host->msg_tail, __ATOMIC_ACQUIRE); tail != head; ++tail) {
+        msg = &host->msg_ring[tail & (LV2H_MSG_RING_SIZE - 1)];
+        if (msg->port && msg->port->inst == inst) {
+            __atomic_store_n(&msg->port, NULL, __ATOMIC_RELEASE);
+        }
+    }
+    lv2h_msg_unlock(host);
+    return LV2H_OK;
+}
+
+static int lv2h_msg_push_array(lv2h_t *host, lv2h_msg_t *msgs, int count) {
+    uint8_t direct[LV2H_BATCH_SIZE];
+    unsigned long head;
+    int queued;
+    int i;
+
+    // An offline render runs the instance on the rendering thread, which
+    // applies its own messages directly, e.g. from the freeze callback.
+    // No other thread may touch the instance until the render ends.
+    queued = 0;
+    for (i = 0; i < count; ++i) {
+        direct[i] = __atomic_load_n(&msgs[i].port->inst->is_rendering, __ATOMIC_ACQUIRE) != 0;
+        if (direct[i] && !lv2h_freeze_owns(msgs[i].port->inst)) {
+            for (i = 0; i < count; ++i) {
+                if (msgs[i].probe_id) lv2h_probe_drop(host, msgs[i].probe_id);
+            }
+            LV2H_RETURN_ERR(host, "lv2h_msg_push: instance is being frozen\n%s", "");
+        }
+        if (!direct[i]) queued += 1;
+    }
+    for (i = 0; i < count; ++i) {
+        if (direct[i]) lv2h_msg_apply(host, msgs + i, msgs[i].port, msgs[i].frame);
+    }
+    if (queued < 1) {
+        return LV2H_OK;
+    }
+
+    // Producers serialize on a lock that the audio thread never takes.
+    // The head is published once so every record lands in the same drain.
+    lv2h_msg_lock(host);
+    head = host->msg_head;
+    if (head - __atomic_load_n(&host->msg_tail, __ATOMIC_ACQUIRE) + queued > LV2H_MSG_RING_SIZE) {
+        lv2h_msg_unlock(host);
+        for (i = 0; i < count; ++i) {
+            if (msgs[i].probe_id) lv2h_probe_drop(host, msgs[i].probe_id);
+        }
+        __sync_fetch_and_add(&host->msg_dropped, queued);
+        LV2H_RETURN_ERR(host, "lv2h_msg_push: queue full\n%s", "");
+    }
+    for (i = 0; i < count; ++i) {
+        if (direct[i]) continue;
+        host->msg_ring[head & (LV2H_MSG_RING_SIZE - 1)] = msgs[i];
+        head += 1;
+    }
+    __atomic_store_n(&host->msg_head, head, __ATOMIC_RELEASE);
+    lv2h_msg_unlock(host);
+    return LV2H_OK;
+}
+
+static int lv2h_msg_fill(lv2h_t *host, lv2h_msg_t *msg, lv2h_port_t *port, int type, uint32_t frame, uint8_t *bytes, int bytes_len, float val) {
+    if (bytes_len < 0 || bytes_len > LV2H_MSG_DATA_SIZE) {
+        LV2H_RETURN_ERR(host, "lv2h_msg_push: message of %d bytes is too long\n", bytes_len);
+    }
+    msg->port = port;
+    msg->type = type;
+    msg->frame = frame < (uint32_t)host->block_size ? frame : (uint32_t)host->block_size - 1;
+    msg->ts_ns = 0;
+    msg->probe_id = type == LV2H_MSG_MIDI && !port->inst->is_rendering ? lv2h_probe_tag(host) : 0;
+    msg->size = (uint32_t)bytes_len;
+    msg->val = val;
+    if (bytes_len > 0) memcpy(msg->data, bytes, bytes_len);
+    return LV2H_OK;
+}
+
+static void lv2h_msg_apply(lv2h_t *host, lv2h_msg_t *msg, lv2h_port_t *port, uint32_t frame) {
+    LV2_Evbuf_Iterator end;
+
+    if (msg->type == LV2H_MSG_MIDI) {
+        // Events are appended, so never go back in time within a block
+        frame = frame > port->atom_frame ? frame : port->atom_frame;
+        end = lv2_evbuf_end(port->atom_input);
+        lv2_evbuf_write(&end, frame, 0, host->urid_midi_event, msg->size, msg->data);
+        port->atom_frame = frame;
+        port->inst->has_events = 1;
+        if (msg->probe_id) {
+            if (port->inst->is_rendering) {
+                lv2h_probe_drop(host, msg->probe_id);
+            } else {
+                lv2h_probe_insert(host, msg->probe_id, port->inst, frame);
+            }
+        }
+    } else {
+        // Control ports hold one value per block
+        port->control_val = msg->val;
+        port->inst->wake = 1;
+    }
+}
+
+long lv2h_msg_ts_offset(lv2h_t *host, long ts_ns, int is_new) {
+    long heard;
+    long need;
+    long target;
+    long max_lead;
+
+    // Timestamped input plays at the frame the device was playing when it
+    // arrived, pushed out by a fixed lead, so latency is constant on the
+    // sample clock however blocks are batched. The lead grows until no input
+    // seen this window would have landed before its block, up to a cap past
+    // which input plays late. Returns the frame relative to this block.
+    heard = host->clock_frame + ((ts_ns - host->clock_ns) * host->sample_rate) / 1000000000L;
+    if (heard > host->frame_clock) {
+        return 0; // stamped in the future, play it now rather than hold the ring
+    }
+    if (is_new) {
+        need = host->block_frame > heard ? host->block_frame - heard : 0;
+        if (need > host->ts_lead_need) host->ts_lead_need = need;
+    }
+    target = heard + host->ts_lead_frames;
+    if (target < host->block_frame) {
+        max_lead = (LV2H_MSG_MAX_LEAD_MS * (long)host->sample_rate) / 1000L;
+        host->ts_lead_frames = host->block_frame - heard < max_lead ? host->block_frame - heard : max_lead;
+        target = heard + host->ts_lead_frames;
+        if (target < host->block_frame) target = host->block_frame;
+    }
+    return target - host->block_frame;
+}
+
+static void lv2h_msg_sort(lv2h_msg_t *msgs, int count) {
+    lv2h_msg_t tmp;
+    int i, j;
+    // Insertion sort, stable, batches are small
+    for (i = 1; i < count; ++i) {
+        tmp = msgs[i];
+        for (j = i; j > 0 && msgs[j - 1].frame > tmp.frame; --j) {
+            msgs[j] = msgs[j - 1];
+        }
+        msgs[j] = tmp;
+    }
+}
+
+static void lv2h_msg_lock(lv2h_t *host) {
+    int state;
+    int spin;
+
+    // Spin briefly since the lock is usually held for a few copies
+    for (spin = 0; spin < LV2H_MSG_SPIN; ++spin) {
+        state = 0;
+        if (__atomic_compare_exchange_n(&host->msg_lock, &state, 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            return;
+        }
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#endif
+    }
+
+    // Then sleep. A SCHED_FIFO producer pinned to the holder's CPU would
+    // otherwise spin forever, and yielding does not let a lower priority
+    // holder run.
+    while (__atomic_exchange_n(&host->msg_lock, 2, __ATOMIC_ACQUIRE) != 0) {
+        syscall(SYS_futex, &host->msg_lock, FUTEX_WAIT_PRIVATE, 2, NULL, NULL, 0);
+    }
+}
+
+static void lv2h_msg_unlock(lv2h_t *host) {
+    if (__atomic_exchange_n(&host->msg_lock, 0, __ATOMIC_RELEASE) == 2) {
+        syscall(SYS_futex, &host->msg_lock, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+    }
+}
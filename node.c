@@ -11,17 +11,25 @@ static int lv2h_process_node(lv2h_event_t *ev);
 int lv2h_run(lv2h_t *host) {
     struct timespec ts;
     long sleep_ns;
+    long trace_ns;
 
     // TODO figure out what to keep in main vs here
     // TODO ?start audio thread
     // TODO ?start tui/keyboard/midi polling thread
     // TODO ?init script engine
 
+    lv2h_rt_enter_thread(host, LV2H_THREAD_SCHED);
+
     while (!host->done) {
         clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
         host->ts_now_ns = ts.tv_sec * 1000000000L + ts.tv_nsec;
         host->ts_next_ns = host->ts_now_ns + host->tick_ns;
+        trace_ns = LV2H_TRACE_BEGIN(host);
         lv2h_process_tick(host);
+        LV2H_TRACE_END(host, "tick", NULL, trace_ns);
+        lv2h_latency_check(host);
+        lv2h_bridge_check(host);
+        lv2h_trace_check_xrun(host);
         clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
         sleep_ns = host->tick_ns - ((ts.tv_sec * 1000000000L + ts.tv_nsec) - host->ts_now_ns);
         if (sleep_ns < 0) sleep_ns = 0;
@@ -55,6 +63,12 @@ int lv2h_node_free(lv2h_node_t *node) {
     return LV2H_OK;
 }
 
+int lv2h_node_set_callback(lv2h_node_t *node, lv2h_node_callback_fn callback, void *udata) {
+    node->callback = callback;
+    node->callback_udata = udata;
+    return LV2H_OK;
+}
+
 int lv2h_node_set_offset(lv2h_node_t *node, long offset_ms) {
     node->offset_ns = offset_ms * 1000000L;
     return LV2H_OK;
@@ -129,11 +143,18 @@ static int lv2h_event_cmp(lv2h_event_t *a, lv2h_event_t *b) {
 
 static int lv2h_process_tick(lv2h_t *host) {
     lv2h_event_t *ev, *ev_tmp;
+    void *udata;
+    long trace_ns;
     LL_FOREACH_SAFE(host->event_list, ev, ev_tmp) {
         if (host->ts_now_ns >= ev->timestamp_ns) {
             if (host->audio_iter >= ev->min_audio_iter) {
                 LL_DELETE(host->event_list, ev);
+                udata = ev->udata; // ev may be freed by callback
+                trace_ns = LV2H_TRACE_BEGIN(host);
+                lv2h_probe_set_due(ev->timestamp_ns);
                 (ev->callback)(ev);
+                lv2h_probe_set_due(0);
+                LV2H_TRACE_END(host, "event", udata, trace_ns);
             }
         } else {
             // We can break because event_list is sorted (LL_INSERT_INORDER)
@@ -159,8 +180,11 @@ static int lv2h_process_node(lv2h_event_t *ev) {
     host = node->host;
     now_ns = host->ts_now_ns; // TODO or ev->timestamp_ns?
 
-    // Invoke node callback
-    (node->callback)(node, node->callback_udata, node->count);
+    // Invoke node callback. Nodes restored from a session have none until
+    // the caller binds one.
+    if (node->callback) {
+        (node->callback)(node, node->callback_udata, node->count);
+    }
 
     // Increment count and bail if limit has been reached
     node->count += 1;
@@ -0,0 +1,264 @@
+#include "lv2h.h"
+
+static int lv2h_pool_alloc_voice(lv2h_pool_t *pool, lv2h_voice_t **out_voice, lv2h_voice_note_t **out_note);
+static int lv2h_pool_release(lv2h_voice_t *voice, lv2h_voice_note_t *note);
+static int lv2h_pool_find_note(lv2h_pool_t *pool, int chan, int note, unsigned long seq, lv2h_voice_t **out_voice, lv2h_voice_note_t **out_note);
+static int lv2h_pool_send(lv2h_voice_t *voice, uint8_t status, int chan, int note, int vel);
+static int lv2h_pool_process_note_off(lv2h_event_t *ev);
+
+int lv2h_pool_new(lv2h_plug_t *plug, int voice_count, int notes_per_voice, char *midi_port_name, lv2h_pool_t **out_pool) {
+    lv2h_t *host;
+    lv2h_pool_t *pool;
+    lv2h_voice_t *voice;
+    int i;
+
+    host = plug->host;
+    if (voice_count < 1 || notes_per_voice < 1) {
+        LV2H_RETURN_ERR(host, "lv2h_pool_new: invalid voice_count=%d notes_per_voice=%d\n", voice_count, notes_per_voice);
+    }
+
+    pool = calloc(1, sizeof(lv2h_pool_t));
+    pool->host = host;
+    pool->plug = plug;
+    pool->notes_per_voice = notes_per_voice;
+    pool->voice_count = voice_count;
+    pool->voice_array = calloc(voice_count, sizeof(lv2h_voice_t));
+    LL_APPEND(host->pool_list, pool);
+
+    for (i = 0; i < voice_count; ++i) {
+        voice = pool->voice_array + i;
+        voice->note_array = calloc(notes_per_voice, sizeof(lv2h_voice_note_t));
+        if (lv2h_inst_new(plug, &voice->inst) != LV2H_OK
+            || lv2h_inst_get_midi_input_port(voice->inst, midi_port_name, &voice->midi_port) != LV2H_OK
+        ) {
+            lv2h_pool_free(pool);
+            return LV2H_ERR;
+        }
+    }
+
+    *out_pool = pool;
+    return LV2H_OK;
+}
+
+int lv2h_pool_free(lv2h_pool_t *pool) {
+    lv2h_pool_note_off_t *note_off, *note_off_tmp;
+    int i;
+
+    // Note offs still scheduled by lv2h_pool_play stay in the event list,
+    // which belongs to the run thread. Detached, they just free themselves
+    // when they fire.
+    LL_FOREACH_SAFE(pool->note_off_list, note_off, note_off_tmp) {
+        LL_DELETE(pool->note_off_list, note_off);
+        __atomic_store_n(&note_off->pool, NULL, __ATOMIC_RELEASE);
+    }
+
+    LL_DELETE(pool->host->pool_list, pool);
+    for (i = 0; i < pool->voice_count; ++i) {
+        // NULL past a voice that failed to instantiate
+        if (pool->voice_array[i].inst) lv2h_inst_free(pool->voice_array[i].inst);
+        if (pool->voice_array[i].note_array) free(pool->voice_array[i].note_array);
+    }
+    free(pool->voice_array);
+    free(pool);
+    return LV2H_OK;
+}
+
+int lv2h_pool_connect(lv2h_pool_t *pool, char *writer_port_name, lv2h_inst_t *reader_inst, char *reader_port_name) {
+    int i;
+    // Every voice writes into the same reader port and the schedule mixes
+    // them in the fan-in
+    for (i = 0; i < pool->voice_count; ++i) {
+        if (lv2h_inst_connect(pool->voice_array[i].inst, writer_port_name, reader_inst, reader_port_name) != LV2H_OK) {
+            return LV2H_ERR;
+        }
+    }
+    return LV2H_OK;
+}
+
+int lv2h_pool_connect_to_audio(lv2h_pool_t *pool, char *writer_port_name, int audio_channel) {
+    int i;
+    for (i = 0; i < pool->voice_count; ++i) {
+        if (lv2h_inst_connect_to_audio(pool->voice_array[i].inst, writer_port_name, audio_channel) != LV2H_OK) {
+            return LV2H_ERR;
+        }
+    }
+    return LV2H_OK;
+}
+
+int lv2h_pool_set_param(lv2h_pool_t *pool, char *port_name, float val) {
+    int i;
+    for (i = 0; i < pool->voice_count; ++i) {
+        if (lv2h_inst_set_param(pool->voice_array[i].inst, port_name, val) != LV2H_OK) {
+            return LV2H_ERR;
+        }
+    }
+    return LV2H_OK;
+}
+
+int lv2h_pool_note_on(lv2h_pool_t *pool, int chan, int note, int vel, unsigned long *out_seq) {
+    lv2h_voice_t *voice;
+    lv2h_voice_note_t *voice_note;
+
+    if (lv2h_pool_alloc_voice(pool, &voice, &voice_note) != LV2H_OK) {
+        return LV2H_ERR;
+    }
+    if (lv2h_pool_send(voice, 0x90, chan, note, vel) != LV2H_OK) {
+        return LV2H_ERR;
+    }
+
+    pool->note_seq += 1;
+    voice_note->chan = chan;
+    voice_note->note = note;
+    voice_note->seq = pool->note_seq;
+    voice_note->is_on = 1;
+    voice->note_count += 1;
+    voice->last_seq = pool->note_seq;
+
+    if (out_seq) *out_seq = pool->note_seq;
+    return LV2H_OK;
+}
+
+int lv2h_pool_note_off(lv2h_pool_t *pool, int chan, int note) {
+    lv2h_voice_t *voice;
+    lv2h_voice_note_t *voice_note;
+    if (lv2h_pool_find_note(pool, chan, note, 0, &voice, &voice_note) != LV2H_OK) {
+        return LV2H_OK; // already released or stolen
+    }
+    return lv2h_pool_release(voice, voice_note);
+}
+
+int lv2h_pool_play(lv2h_pool_t *pool, int chan, int note1, int note2, int note3, int note4, int vel, int len_ms) {
+    lv2h_pool_note_off_t *note_off;
+    unsigned long seq;
+    int notes[4];
+    int notes_len;
+    int i;
+
+    notes_len = 0;
+    if (note1 > 0) notes[notes_len++] = note1;
+    if (note2 > 0) notes[notes_len++] = note2;
+    if (note3 > 0) notes[notes_len++] = note3;
+    if (note4 > 0) notes[notes_len++] = note4;
+
+    for (i = 0; i < notes_len; ++i) {
+        if (lv2h_pool_note_on(pool, chan, notes[i], vel, &seq) != LV2H_OK) {
+            return LV2H_ERR;
+        }
+        // Release by sequence number so a retriggered note is not cut short.
+        // Allocated per note since the record can outlive the pool.
+        note_off = calloc(1, sizeof(lv2h_pool_note_off_t));
+        note_off->pool = pool;
+        note_off->seq = seq;
+        LL_PREPEND(pool->note_off_list, note_off);
+        lv2h_schedule_event(pool->host, pool->host->ts_now_ns + (len_ms * 1000000L), 1, lv2h_pool_process_note_off, note_off);
+    }
+    return LV2H_OK;
+}
+
+static int lv2h_pool_alloc_voice(lv2h_pool_t *pool, lv2h_voice_t **out_voice, lv2h_voice_note_t **out_note) {
+    lv2h_voice_t *voice, *best_voice, *steal_voice;
+    lv2h_voice_note_t *steal_note;
+    int i, n;
+
+    // Least loaded voice wins. Ties go to the voice idle the longest so
+    // consecutive notes spread across instances.
+    best_voice = NULL;
+    for (i = 0; i < pool->voice_count; ++i) {
+        voice = pool->voice_array + i;
+        if (voice->note_count >= pool->notes_per_voice) continue;
+        if (!best_voice
+            || voice->note_count < best_voice->note_count
+            || (voice->note_count == best_voice->note_count && voice->last_seq < best_voice->last_seq)
+        ) {
+            best_voice = voice;
+        }
+    }
+
+    if (best_voice) {
+        for (n = 0; n < pool->notes_per_voice; ++n) {
+            if (!best_voice->note_array[n].is_on) {
+                *out_voice = best_voice;
+                *out_note = best_voice->note_array + n;
+                return LV2H_OK;
+            }
+        }
+    }
+
+    // Every voice is full. Steal the oldest note in the pool.
+    steal_voice = NULL;
+    steal_note = NULL;
+    for (i = 0; i < pool->voice_count; ++i) {
+        voice = pool->voice_array + i;
+        for (n = 0; n < pool->notes_per_voice; ++n) {
+            if (!steal_note || voice->note_array[n].seq < steal_note->seq) {
+                steal_voice = voice;
+                steal_note = voice->note_array + n;
+            }
+        }
+    }
+    if (lv2h_pool_release(steal_voice, steal_note) != LV2H_OK) {
+        return LV2H_ERR;
+    }
+    pool->steal_count += 1;
+
+    *out_voice = steal_voice;
+    *out_note = steal_note;
+    return LV2H_OK;
+}
+
+static int lv2h_pool_release(lv2h_voice_t *voice, lv2h_voice_note_t *note) {
+    int rv;
+    rv = lv2h_pool_send(voice, 0x80, note->chan, note->note, 0);
+    note->is_on = 0;
+    voice->note_count -= 1;
+    return rv;
+}
+
+static int lv2h_pool_find_note(lv2h_pool_t *pool, int chan, int note, unsigned long seq, lv2h_voice_t **out_voice, lv2h_voice_note_t **out_note) {
+    lv2h_voice_t *voice;
+    lv2h_voice_note_t *voice_note;
+    int i, n;
+
+    // Match by sequence number if given, else the oldest matching note
+    *out_note = NULL;
+    for (i = 0; i < pool->voice_count; ++i) {
+        voice = pool->voice_array + i;
+        for (n = 0; n < pool->notes_per_voice; ++n) {
+            voice_note = voice->note_array + n;
+            if (!voice_note->is_on) continue;
+            if (seq ? voice_note->seq != seq : (voice_note->chan != chan || voice_note->note != note)) continue;
+            if (!*out_note || voice_note->seq < (*out_note)->seq) {
+                *out_voice = voice;
+                *out_note = voice_note;
+            }
+        }
+    }
+    return *out_note ? LV2H_OK : LV2H_ERR;
+}
+
+static int lv2h_pool_send(lv2h_voice_t *voice, uint8_t status, int chan, int note, int vel) {
+    uint8_t msg[3];
+    msg[0] = status + (chan >= 0x00 && chan <= 0x0f ? chan : 0x00);
+    msg[1] = (uint8_t)note;
+    msg[2] = (uint8_t)vel;
+    return lv2h_port_send_midi(voice->midi_port, msg, 3);
+}
+
+static int lv2h_pool_process_note_off(lv2h_event_t *ev) {
+    lv2h_pool_note_off_t *note_off;
+    lv2h_pool_t *pool;
+    lv2h_voice_t *voice;
+    lv2h_voice_note_t *voice_note;
+    int rv;
+
+    note_off = (lv2h_pool_note_off_t*)ev->udata;
+    rv = LV2H_OK;
+    if ((pool = __atomic_load_n(&note_off->pool, __ATOMIC_ACQUIRE))) {
+        LL_DELETE(pool->note_off_list, note_off);
+        if (lv2h_pool_find_note(pool, 0, 0, note_off->seq, &voice, &voice_note) == LV2H_OK) {
+            rv = lv2h_pool_release(voice, voice_note);
+        }
+    }
+    free(note_off);
+    return rv;
+}
@@ -0,0 +1,140 @@
+#include "lv2h.h"
+
+static int lv2h_preset_new(lv2h_plug_t *plug, char *preset_str, lv2h_preset_t **out_preset);
+static void lv2h_preset_add_value(const char *port_symbol, void *user_data, const void *value, uint32_t size, uint32_t type);
+
+int lv2h_inst_load_preset(lv2h_inst_t *inst, char *preset_str) {
+    lv2h_preset_t *preset;
+    if (lv2h_preset_get(inst->plug, preset_str, &preset) != LV2H_OK) {
+        return LV2H_ERR;
+    }
+    return lv2h_inst_apply_preset(inst, preset);
+}
+
+int lv2h_preset_get(lv2h_plug_t *plug, char *preset_str, lv2h_preset_t **out_preset) {
+    lv2h_preset_t *preset;
+
+    HASH_FIND_STR(plug->preset_map, preset_str, preset);
+    if (!preset) {
+        if (lv2h_preset_new(plug, preset_str, &preset) != LV2H_OK) {
+            return LV2H_ERR;
+        }
+        HASH_ADD_KEYPTR(hh, plug->preset_map, preset->uri_str, strlen(preset->uri_str), preset);
+    }
+
+    *out_preset = preset;
+    return LV2H_OK;
+}
+
+int lv2h_inst_apply_preset(lv2h_inst_t *inst, lv2h_preset_t *preset) {
+    lv2h_t *host;
+
+    host = inst->plug->host;
+    if (preset->plug != inst->plug) {
+        LV2H_RETURN_ERR(host, "lv2h_inst_apply_preset: preset %s is for another plugin\n", preset->uri_str);
+    }
+
+    // Port values are picked up by the audio thread at the next block the
+    // instance runs in
+    if (!preset->state || !inst->lilv_inst) {
+        // Bridged instances keep their plugin in another process and only
+        // get the port values
+        __atomic_store_n(&inst->pending_preset, preset, __ATOMIC_RELEASE);
+        return LV2H_OK;
+    }
+
+    // Plugin state beyond port values goes through the plugin's restore,
+    // which must not overlap run and is not realtime safe, so a stateful
+    // switch is not realtime. It runs here under the instance lock, and the
+    // instance sits out any block that lands in the meantime. The ports are
+    // queued before unlocking, so the next run gets both.
+    lv2h_inst_lock(inst);
+    lilv_state_restore(preset->state, inst->lilv_inst, NULL, NULL, 0, host->features);
+    __atomic_store_n(&inst->pending_preset, preset, __ATOMIC_RELEASE);
+    lv2h_inst_unlock(inst);
+    return LV2H_OK;
+}
+
+int lv2h_preset_apply_ports(lv2h_inst_t *inst, lv2h_preset_t *preset) {
+    uint32_t i;
+    for (i = 0; i < preset->value_count; ++i) {
+        inst->port_array[preset->port_index_array[i]].control_val = preset->value_array[i];
+    }
+    inst->wake = 1;
+    return LV2H_OK;
+}
+
+int lv2h_preset_free_all(lv2h_plug_t *plug) {
+    lv2h_preset_t *preset, *preset_tmp;
+    HASH_ITER(hh, plug->preset_map, preset, preset_tmp) {
+        HASH_DEL(plug->preset_map, preset);
+        if (preset->state) lilv_state_free(preset->state);
+        free(preset->port_index_array);
+        free(preset->value_array);
+        free(preset->uri_str);
+        free(preset);
+    }
+    return LV2H_OK;
+}
+
+static int lv2h_preset_new(lv2h_plug_t *plug, char *preset_str, lv2h_preset_t **out_preset) {
+    lv2h_t *host;
+    lv2h_preset_t *preset;
+    LilvNode *preset_uri;
+    LilvState *state;
+
+    host = plug->host;
+    preset_uri = lilv_new_uri(host->lilv_world, preset_str);
+    state = lilv_state_new_from_world(host->lilv_world, &host->urid_map, preset_uri);
+    lilv_node_free(preset_uri);
+    if (!state) {
+        LV2H_RETURN_ERR(host, "lv2h_inst_load_preset: preset not found for %s\n", preset_str);
+    }
+
+    preset = calloc(1, sizeof(lv2h_preset_t));
+    preset->plug = plug;
+    preset->uri_str = strdup(preset_str);
+    preset->port_index_array = calloc(plug->port_count, sizeof(uint32_t));
+    preset->value_array = calloc(plug->port_count, sizeof(float));
+
+    // Resolve port symbols once so applying is a plain array walk
+    lilv_state_emit_port_values(state, lv2h_preset_add_value, preset);
+
+    // Keep the state only if there is more to restore than port values
+    if (lilv_state_get_num_properties(state) > 0) {
+        preset->state = state;
+    } else {
+        lilv_state_free(state);
+    }
+
+    *out_preset = preset;
+    return LV2H_OK;
+}
+
+static void lv2h_preset_add_value(const char *port_symbol, void *user_data, const void *value, uint32_t size, uint32_t type) {
+    lv2h_preset_t *preset;
+    lv2h_t *host;
+    LilvNode *symbol;
+    const LilvPort *lilv_port;
+    uint32_t port_index;
+
+    (void)size;
+
+    preset = (lv2h_preset_t*)user_data;
+    host = preset->plug->host;
+
+    if (type != 0 && type != host->urid_map.map(host->urid_map.handle, LV2_ATOM__Float)) {
+        return;
+    }
+
+    symbol = lilv_new_string(host->lilv_world, port_symbol);
+    lilv_port = lilv_plugin_get_port_by_symbol(preset->plug->lilv_plugin, symbol);
+    lilv_node_free(symbol);
+    if (!lilv_port) return;
+    port_index = lilv_port_get_index(preset->plug->lilv_plugin, lilv_port);
+    if (port_index >= preset->plug->port_count || preset->value_count >= preset->plug->port_count) return;
+
+    preset->port_index_array[preset->value_count] = port_index;
+    preset->value_array[preset->value_count] = *((float*)value);
+    preset->value_count += 1;
+}
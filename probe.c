@@ -0,0 +1,227 @@
+#include "lv2h.h"
+
+#define LV2H_PROBE_FREE 0
+#define LV2H_PROBE_SUBMITTED 1
+#define LV2H_PROBE_INSERTED 2
+#define LV2H_PROBE_RUN 3
+
+static void lv2h_probe_add(lv2h_t *host, int stage, long ns);
+static long lv2h_probe_percentile(lv2h_probe_hist_t *hist, double pct);
+
+static const char *lv2h_probe_stage_names[LV2H_PROBE_STAGE_COUNT] = {
+    "sched",
+    "queue",
+    "run",
+    "output",
+    "total",
+};
+
+// When a node callback is running, the time it was due. Set per thread
+// since MIDI input tags messages concurrently.
+static __thread long lv2h_probe_due_ns = 0;
+
+int lv2h_probe_set_rate(lv2h_t *host, int every_n) {
+    if (every_n < 0) {
+        LV2H_RETURN_ERR(host, "lv2h_probe_set_rate: invalid rate %d\n", every_n);
+    }
+    __atomic_store_n(&host->probe_rate, every_n, __ATOMIC_RELEASE);
+    return LV2H_OK;
+}
+
+int lv2h_probe_get_hist(lv2h_t *host, int stage, lv2h_probe_hist_t *out_hist) {
+    lv2h_probe_hist_t *hist;
+    int i;
+
+    if (stage < 0 || stage >= LV2H_PROBE_STAGE_COUNT) {
+        LV2H_RETURN_ERR(host, "lv2h_probe_get_hist: invalid stage %d\n", stage);
+    }
+    hist = &host->probe_hist_array[stage];
+    out_hist->count = __atomic_load_n(&hist->count, __ATOMIC_RELAXED);
+    out_hist->sum_ns = __atomic_load_n(&hist->sum_ns, __ATOMIC_RELAXED);
+    out_hist->max_ns = __atomic_load_n(&hist->max_ns, __ATOMIC_RELAXED);
+    for (i = 0; i < LV2H_PROBE_BUCKETS; ++i) {
+        out_hist->bucket[i] = __atomic_load_n(&hist->bucket[i], __ATOMIC_RELAXED);
+    }
+    return LV2H_OK;
+}
+
+int lv2h_probe_reset(lv2h_t *host) {
+    // Counts may be off by a probe completing mid-reset, which is fine
+    // for tuning
+    memset(host->probe_hist_array, 0, sizeof(host->probe_hist_array));
+    __atomic_store_n(&host->probe_lost, 0, __ATOMIC_RELAXED);
+    return LV2H_OK;
+}
+
+int lv2h_probe_report(lv2h_t *host, FILE *fp) {
+    lv2h_probe_hist_t hist;
+    int stage;
+
+    fprintf(fp, "%-8s %8s %10s %10s %10s %10s %10s\n", "stage", "count", "mean_us", "p50_us", "p90_us", "p99_us", "max_us");
+    for (stage = 0; stage < LV2H_PROBE_STAGE_COUNT; ++stage) {
+        lv2h_probe_get_hist(host, stage, &hist);
+        fprintf(fp, "%-8s %8lu %10.1f %10.1f %10.1f %10.1f %10.1f\n",
+            lv2h_probe_stage_names[stage],
+            hist.count,
+            hist.count ? (double)hist.sum_ns / hist.count / 1000.0 : 0.0,
+            lv2h_probe_percentile(&hist, 0.50) / 1000.0,
+            lv2h_probe_percentile(&hist, 0.90) / 1000.0,
+            lv2h_probe_percentile(&hist, 0.99) / 1000.0,
+            hist.max_ns / 1000.0);
+    }
+    fprintf(fp, "lost %lu\n", __atomic_load_n(&host->probe_lost, __ATOMIC_RELAXED));
+    return LV2H_OK;
+}
+
+void lv2h_probe_set_due(long due_ns) {
+    struct timespec ts;
+
+    // Event times are on CLOCK_MONOTONIC_RAW. Stages are measured on the
+    // trace clock, so move the due time over by the current offset.
+    if (due_ns) {
+        clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+        due_ns += lv2h_trace_now_ns() - (ts.tv_sec * 1000000000L + ts.tv_nsec);
+    }
+    lv2h_probe_due_ns = due_ns;
+}
+
+int lv2h_probe_tag(lv2h_t *host) {
+    lv2h_probe_t *probe;
+    unsigned long seq;
+    int rate;
+    int state;
+
+    // Sample one in every_n messages. A message finding its slot still
+    // in flight goes untagged.
+    if (!(rate = __atomic_load_n(&host->probe_rate, __ATOMIC_ACQUIRE))) {
+        return 0;
+    }
+    seq = __sync_fetch_and_add(&host->probe_seq, 1);
+    if (seq % rate != 0) {
+        return 0;
+    }
+    probe = &host->probe_array[(seq / rate) & (LV2H_PROBE_SLOTS - 1)];
+    state = LV2H_PROBE_FREE;
+    if (!__atomic_compare_exchange_n(&probe->state, &state, LV2H_PROBE_SUBMITTED, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+        __sync_fetch_and_add(&host->probe_lost, 1);
+        return 0;
+    }
+    probe->submit_ns = lv2h_trace_now_ns();
+    probe->due_ns = lv2h_probe_due_ns;
+    return (int)(probe - host->probe_array) + 1;
+}
+
+void lv2h_probe_drop(lv2h_t *host, int probe_id) {
+    // Queue full, purged, or rendered offline
+    __atomic_store_n(&host->probe_array[probe_id - 1].state, LV2H_PROBE_FREE, __ATOMIC_RELEASE);
+    __sync_fetch_and_add(&host->probe_lost, 1);
+}
+
+void lv2h_probe_insert(lv2h_t *host, int probe_id, lv2h_inst_t *inst, uint32_t frame) {
+    lv2h_probe_t *probe;
+
+    // Audio thread, as the event lands in the atom buffer
+    probe = &host->probe_array[probe_id - 1];
+    probe->insert_ns = lv2h_trace_now_ns();
+    probe->inst = inst;
+    probe->frame = frame;
+    probe->state = LV2H_PROBE_INSERTED;
+    inst->has_probe = 1;
+    host->probe_pending += 1;
+}
+
+void lv2h_probe_run(lv2h_t *host, lv2h_inst_t *inst) {
+    lv2h_probe_t *probe;
+    long now_ns;
+    int i;
+
+    // Audio thread, right after the instance ran
+    inst->has_probe = 0;
+    now_ns = lv2h_trace_now_ns();
+    for (i = 0; i < LV2H_PROBE_SLOTS; ++i) {
+        probe = &host->probe_array[i];
+        if (probe->state == LV2H_PROBE_INSERTED && probe->inst == inst) {
+            probe->run_ns = now_ns;
+            probe->state = LV2H_PROBE_RUN;
+        }
+    }
+}
+
+void lv2h_probe_output(lv2h_t *host, long device_latency_ns) {
+    lv2h_probe_t *probe;
+    long now_ns;
+    long heard_ns;
+    long begin_ns;
+    int i;
+
+    // Audio thread, once the block is handed to the device. The event is
+    // heard after the device latency plus its offset into the block.
+    if (host->probe_pending < 1) {
+        return;
+    }
+    now_ns = lv2h_trace_now_ns();
+    for (i = 0; i < LV2H_PROBE_SLOTS; ++i) {
+        probe = &host->probe_array[i];
+        if (probe->state == LV2H_PROBE_RUN) {
+            heard_ns = now_ns + device_latency_ns + ((long)probe->frame * 1000000000L) / host->sample_rate;
+            begin_ns = probe->submit_ns;
+            if (probe->due_ns > 0 && probe->due_ns <= probe->submit_ns) {
+                lv2h_probe_add(host, LV2H_PROBE_STAGE_SCHED, probe->submit_ns - probe->due_ns);
+                begin_ns = probe->due_ns;
+            }
+            lv2h_probe_add(host, LV2H_PROBE_STAGE_QUEUE, probe->insert_ns - probe->submit_ns);
+            lv2h_probe_add(host, LV2H_PROBE_STAGE_RUN, probe->run_ns - probe->insert_ns);
+            lv2h_probe_add(host, LV2H_PROBE_STAGE_OUTPUT, heard_ns - probe->run_ns);
+            lv2h_probe_add(host, LV2H_PROBE_STAGE_TOTAL, heard_ns - begin_ns);
+        } else if (probe->state == LV2H_PROBE_INSERTED) {
+            // Instance did not run this block, e.g. asleep or skipped
+            __sync_fetch_and_add(&host->probe_lost, 1);
+        } else {
+            continue;
+        }
+        __atomic_store_n(&probe->state, LV2H_PROBE_FREE, __ATOMIC_RELEASE);
+    }
+    host->probe_pending = 0;
+}
+
+static void lv2h_probe_add(lv2h_t *host, int stage, long ns) {
+    lv2h_probe_hist_t *hist;
+    long us;
+    long max_ns;
+    int bucket;
+
+    // Bucket b holds [2^(b-1), 2^b) us, the last one everything above
+    hist = &host->probe_hist_array[stage];
+    if (ns < 0) ns = 0;
+    us = ns / 1000;
+    for (bucket = 0; us > 0 && bucket < LV2H_PROBE_BUCKETS - 1; ++bucket) {
+        us >>= 1;
+    }
+    __sync_fetch_and_add(&hist->bucket[bucket], 1);
+    __sync_fetch_and_add(&hist->count, 1);
+    __sync_fetch_and_add(&hist->sum_ns, ns);
+    max_ns = __atomic_load_n(&hist->max_ns, __ATOMIC_RELAXED);
+    while (ns > max_ns && !__atomic_compare_exchange_n(&hist->max_ns, &max_ns, ns, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+static long lv2h_probe_percentile(lv2h_probe_hist_t *hist, double pct) {
+    unsigned long target;
+    unsigned long seen;
+    int bucket;
+
+    // Upper edge of the bucket holding the percentile, capped at the max
+    if (hist->count < 1) {
+        return 0;
+    }
+    target = (unsigned long)(pct * hist->count);
+    if (target < 1) target = 1;
+    seen = 0;
+    for (bucket = 0; bucket < LV2H_PROBE_BUCKETS; ++bucket) {
+        seen += hist->bucket[bucket];
+        if (seen >= target) break;
+    }
+    if (bucket >= LV2H_PROBE_BUCKETS - 1) {
+        return hist->max_ns;
+    }
+    return (1L << bucket) * 1000L < hist->max_ns ? (1L << bucket) * 1000L : hist->max_ns;
+}
@@ -0,0 +1,328 @@
+#include "lv2h.h"
+#include <errno.h>
+#include <fcntl.h>
+
+#define LV2H_REC_HEADER_SIZE 4096 // data starts block aligned for O_DIRECT
+#define LV2H_REC_CHUNK_FRAMES 16384 // per write, a multiple of 4096 bytes at any channel count
+#define LV2H_REC_RING_SECONDS 4
+#define LV2H_REC_POLL_NS 10000000L
+
+static void *lv2h_rec_run(void *arg);
+static void lv2h_rec_write_block(lv2h_rec_t *rec, int frame_count);
+static int lv2h_rec_drain(lv2h_rec_t *rec, int is_final);
+static int lv2h_rec_write_header(lv2h_rec_t *rec);
+static void lv2h_rec_put_u32(uint8_t *dst, uint32_t val);
+static void lv2h_rec_put_u16(uint8_t *dst, uint16_t val);
+static int lv2h_rec_destroy(lv2h_rec_t *rec);
+
+int lv2h_rec_new(lv2h_t *host, char *path, lv2h_port_t **port_array, int port_count, int flags, lv2h_rec_t **out_rec) {
+    lv2h_rec_t *rec;
+    lv2h_port_t *master_port_array[2];
+    size_t ring_frames;
+    int open_flags;
+    int err;
+    int slot;
+    int i;
+
+    if (!port_array) {
+        // Master bus
+        master_port_array[0] = host->audio_inst->port_array + 0;
+        master_port_array[1] = host->audio_inst->port_array + 1;
+        port_array = master_port_array;
+        port_count = 2;
+    }
+    if (port_count < 1 || port_count > LV2H_REC_MAX_CHANNELS) {
+        LV2H_RETURN_ERR(host, "lv2h_rec_new: invalid port_count %d\n", port_count);
+    }
+    for (i = 0; i < port_count; ++i) {
+        if (!port_array[i]->reader_block_mixed && !port_array[i]->writer_block) {
+            LV2H_RETURN_ERR(host, "lv2h_rec_new: %s is not an audio port\n", port_array[i]->port_name ? port_array[i]->port_name : "port");
+        }
+    }
+
+    rec = calloc(1, sizeof(lv2h_rec_t));
+    rec->host = host;
+    rec->fd = -1;
+    rec->channel_count = port_count;
+    rec->header_interval_ns = LV2H_REC_HEADER_INTERVAL_MS * 1000000L;
+    rec->is_direct = (flags & LV2H_REC_DIRECT) ? 1 : 0;
+    for (i = 0; i < port_count; ++i) {
+        rec->port_array[i] = port_array[i];
+    }
+
+    // Power of two frames so the audio thread masks rather than divides
+    ring_frames = LV2H_REC_CHUNK_FRAMES * 2;
+    while (ring_frames < (size_t)host->sample_rate * LV2H_REC_RING_SECONDS) ring_frames *= 2;
+    rec->ring_frames = ring_frames;
+
+    // Touch every page now so the audio thread never faults on the ring
+    if (!(rec->ring = malloc(ring_frames * port_count * sizeof(float)))
+        || posix_memalign((void**)&rec->chunk, LV2H_REC_HEADER_SIZE, LV2H_REC_CHUNK_FRAMES * port_count * sizeof(float)) != 0
+    ) {
+        rec->chunk = NULL;
+        lv2h_rec_destroy(rec);
+        LV2H_RETURN_ERR(host, "lv2h_rec_new: could not allocate ring\n%s", "");
+    }
+    memset(rec->ring, 0, ring_frames * port_count * sizeof(float));
+
+    open_flags = O_WRONLY | O_CREAT | O_TRUNC;
+    if (rec->is_direct) open_flags |= O_DIRECT;
+    if ((rec->fd = open(path, open_flags, 0644)) < 0) {
+        err = errno;
+        lv2h_rec_destroy(rec);
+        LV2H_RETURN_ERR(host, "lv2h_rec_new: open %s: %s\n", path, strerror(err));
+    }
+    if (lv2h_rec_write_header(rec) != LV2H_OK) {
+        err = rec->write_errno;
+        lv2h_rec_destroy(rec);
+        LV2H_RETURN_ERR(host, "lv2h_rec_new: write %s: %s\n", path, strerror(err));
+    }
+
+    for (slot = 0; slot < LV2H_REC_MAX; ++slot) {
+        if (!host->rec_array[slot]) break;
+    }
+    if (slot >= LV2H_REC_MAX) {
+        lv2h_rec_destroy(rec);
+        LV2H_RETURN_ERR(host, "lv2h_rec_new: too many recorders\n%s", "");
+    }
+
+    pthread_create(&rec->thread, NULL, lv2h_rec_run, rec);
+    rec->slot = slot;
+    __atomic_store_n(&host->rec_array[slot], rec, __ATOMIC_RELEASE);
+
+    *out_rec = rec;
+    return LV2H_OK;
+}
+
+int lv2h_rec_free(lv2h_rec_t *rec) {
+    lv2h_t *host;
+    int rv;
+
+    // Unpublish and wait for the audio thread to finish any block that
+    // could still be writing to the ring
+    host = rec->host;
+    __atomic_store_n(&host->rec_array[rec->slot], NULL, __ATOMIC_RELEASE);
+    lv2h_graph_compile(host);
+    lv2h_graph_sync(host);
+
+    // The writer drains what is left and finalizes the header
+    __atomic_store_n(&rec->done, 1, __ATOMIC_RELEASE);
+    pthread_join(rec->thread, NULL);
+    rv = rec->write_errno ? LV2H_ERR : LV2H_OK;
+    if (rv != LV2H_OK) {
+        snprintf(host->errstr, sizeof(host->errstr), "lv2h_rec_free: write: %s\n", strerror(rec->write_errno));
+    }
+    lv2h_rec_destroy(rec);
+    return rv;
+}
+
+int lv2h_rec_get_stats(lv2h_rec_t *rec, lv2h_rec_stats_t *out_stats) {
+    out_stats->frames_written = __atomic_load_n(&rec->frames_written, __ATOMIC_RELAXED);
+    out_stats->ring_frames = rec->ring_frames;
+    out_stats->high_water_frames = __atomic_load_n(&rec->high_water_frames, __ATOMIC_RELAXED);
+    out_stats->overrun_count = __atomic_load_n(&rec->overrun_count, __ATOMIC_RELAXED);
+    out_stats->write_errno = __atomic_load_n(&rec->write_errno, __ATOMIC_RELAXED);
+    return LV2H_OK;
+}
+
+void lv2h_rec_tap(lv2h_t *host, int frame_count) {
+    lv2h_rec_t *rec;
+    int i;
+    // Runs on the audio thread after the schedule
+    for (i = 0; i < LV2H_REC_MAX; ++i) {
+        if ((rec = __atomic_load_n(&host->rec_array[i], __ATOMIC_ACQUIRE))) {
+            lv2h_rec_write_block(rec, frame_count);
+        }
+    }
+}
+
+int lv2h_rec_purge_inst(lv2h_inst_t *inst) {
+    lv2h_rec_t *rec;
+    lv2h_port_t *port;
+    int i, c;
+
+    // Channels tapping an instance that is going away record silence. The
+    // caller syncs with the audio thread before the ports are freed.
+    for (i = 0; i < LV2H_REC_MAX; ++i) {
+        if (!(rec = inst->plug->host->rec_array[i])) continue;
+        for (c = 0; c < rec->channel_count; ++c) {
+            port = rec->port_array[c];
+            if (port && port->inst == inst) {
+                __atomic_store_n(&rec->port_array[c], NULL, __ATOMIC_RELEASE);
+            }
+        }
+    }
+    return LV2H_OK;
+}
+
+static void lv2h_rec_write_block(lv2h_rec_t *rec, int frame_count) {
+    lv2h_port_t *port;
+    float *block;
+    float *dst;
+    unsigned long head, fill;
+    size_t mask;
+    int c, f;
+
+    head = rec->head;
+    fill = head - __atomic_load_n(&rec->tail, __ATOMIC_ACQUIRE);
+    if (fill + frame_count > rec->ring_frames) {
+        // Writer fell behind. Drop the block rather than wait.
+        __sync_fetch_and_add(&rec->overrun_count, 1);
+        return;
+    }
+
+    mask = rec->ring_frames - 1;
+    for (c = 0; c < rec->channel_count; ++c) {
+        port = __atomic_load_n(&rec->port_array[c], __ATOMIC_ACQUIRE);
+        block = port ? (port->reader_block_mixed ? port->reader_block_mixed : port->writer_block) : NULL;
+        for (f = 0; f < frame_count; ++f) {
+            dst = rec->ring + ((head + f) & mask) * rec->channel_count + c;
+            *dst = block ? block[f] : 0.f;
+        }
+    }
+    __atomic_store_n(&rec->head, head + frame_count, __ATOMIC_RELEASE);
+
+    if (fill + frame_count > rec->high_water_frames) {
+        __atomic_store_n(&rec->high_water_frames, fill + frame_count, __ATOMIC_RELAXED);
+    }
+}
+
+static void *lv2h_rec_run(void *arg) {
+    lv2h_rec_t *rec;
+    struct timespec ts;
+    long now_ns, header_ns;
+    int done;
+
+    rec = (lv2h_rec_t*)arg;
+    header_ns = lv2h_trace_now_ns();
+    ts.tv_sec = 0;
+    ts.tv_nsec = LV2H_REC_POLL_NS;
+
+    for (;;) {
+        done = __atomic_load_n(&rec->done, __ATOMIC_ACQUIRE);
+        if (lv2h_rec_drain(rec, done) != LV2H_OK || done) {
+            break;
+        }
+
+        // Keep the header current so a crash leaves a playable file
+        now_ns = lv2h_trace_now_ns();
+        if (now_ns - header_ns >= rec->header_interval_ns) {
+            lv2h_rec_write_header(rec);
+            header_ns = now_ns;
+        }
+        nanosleep(&ts, NULL);
+    }
+
+    lv2h_rec_write_header(rec);
+    if (rec->is_direct) {
+        // Drop the zero padding of the last aligned write
+        if (ftruncate(rec->fd, LV2H_REC_HEADER_SIZE + rec->data_bytes) != 0 && !rec->write_errno) {
+            rec->write_errno = errno;
+        }
+    }
+    return NULL;
+}
+
+static int lv2h_rec_drain(lv2h_rec_t *rec, int is_final) {
+    unsigned long head, tail;
+    size_t frame_bytes;
+    size_t len, pad;
+    size_t mask;
+    ssize_t rv;
+    long n, i;
+
+    // Whole chunks while running. The remainder is written once at the
+    // end so every write stays block aligned.
+    frame_bytes = rec->channel_count * sizeof(float);
+    mask = rec->ring_frames - 1;
+    for (;;) {
+        head = __atomic_load_n(&rec->head, __ATOMIC_ACQUIRE);
+        tail = rec->tail;
+        n = head - tail;
+        if (n > LV2H_REC_CHUNK_FRAMES) n = LV2H_REC_CHUNK_FRAMES;
+        if (n < 1 || (n < LV2H_REC_CHUNK_FRAMES && !is_final)) {
+            return LV2H_OK;
+        }
+
+        for (i = 0; i < n; i += len / frame_bytes) {
+            len = (rec->ring_frames - ((tail + i) & mask)) * frame_bytes;
+            if (len > (n - i) * frame_bytes) len = (n - i) * frame_bytes;
+            memcpy((uint8_t*)rec->chunk + i * frame_bytes, rec->ring + ((tail + i) & mask) * rec->channel_count, len);
+        }
+        __atomic_store_n(&rec->tail, tail + n, __ATOMIC_RELEASE);
+
+        len = n * frame_bytes;
+        pad = 0;
+        if (rec->is_direct && len % LV2H_REC_HEADER_SIZE) {
+            pad = LV2H_REC_HEADER_SIZE - (len % LV2H_REC_HEADER_SIZE);
+            memset((uint8_t*)rec->chunk + len, 0, pad);
+        }
+        if ((rv = pwrite(rec->fd, rec->chunk, len + pad, LV2H_REC_HEADER_SIZE + rec->data_bytes)) < 0) {
+            if (errno == EINTR) continue;
+            rec->write_errno = errno;
+            return LV2H_ERR;
+        }
+        rec->data_bytes += len;
+        __atomic_store_n(&rec->frames_written, rec->frames_written + n, __ATOMIC_RELAXED);
+    }
+}
+
+static int lv2h_rec_write_header(lv2h_rec_t *rec) {
+    uint8_t *header;
+    uint32_t data_bytes;
+    int channels, rate;
+    int rv;
+
+    // RIFF/WAVE, 32-bit float. A JUNK chunk pads the header to one
+    // aligned block. Sizes saturate past 4 GiB.
+    header = (uint8_t*)rec->chunk;
+    if (!rec->chunk) return LV2H_ERR;
+    channels = rec->channel_count;
+    rate = rec->host->sample_rate;
+    data_bytes = rec->data_bytes > 0xffffffffUL - LV2H_REC_HEADER_SIZE ? 0xffffffffUL - LV2H_REC_HEADER_SIZE : (uint32_t)rec->data_bytes;
+
+    // The chunk buffer is idle whenever the header is written
+    memset(header, 0, LV2H_REC_HEADER_SIZE);
+    memcpy(header + 0, "RIFF", 4);
+    lv2h_rec_put_u32(header + 4, LV2H_REC_HEADER_SIZE - 8 + data_bytes);
+    memcpy(header + 8, "WAVE", 4);
+    memcpy(header + 12, "fmt ", 4);
+    lv2h_rec_put_u32(header + 16, 16);
+    lv2h_rec_put_u16(header + 20, 3); // WAVE_FORMAT_IEEE_FLOAT
+    lv2h_rec_put_u16(header + 22, channels);
+    lv2h_rec_put_u32(header + 24, rate);
+    lv2h_rec_put_u32(header + 28, rate * channels * sizeof(float));
+    lv2h_rec_put_u16(header + 32, channels * sizeof(float));
+    lv2h_rec_put_u16(header + 34, 32);
+    memcpy(header + 36, "JUNK", 4);
+    lv2h_rec_put_u32(header + 40, LV2H_REC_HEADER_SIZE - 52);
+    memcpy(header + LV2H_REC_HEADER_SIZE - 8, "data", 4);
+    lv2h_rec_put_u32(header + LV2H_REC_HEADER_SIZE - 4, data_bytes);
+
+    while ((rv = pwrite(rec->fd, header, LV2H_REC_HEADER_SIZE, 0)) < 0 && errno == EINTR);
+    if (rv < 0) {
+        if (!rec->write_errno) rec->write_errno = errno;
+        return LV2H_ERR;
+    }
+    return LV2H_OK;
+}
+
+static void lv2h_rec_put_u32(uint8_t *dst, uint32_t val) {
+    dst[0] = val & 0xff;
+    dst[1] = (val >> 8) & 0xff;
+    dst[2] = (val >> 16) & 0xff;
+    dst[3] = (val >> 24) & 0xff;
+}
+
+static void lv2h_rec_put_u16(uint8_t *dst, uint16_t val) {
+    dst[0] = val & 0xff;
+    dst[1] = (val >> 8) & 0xff;
+}
+
+static int lv2h_rec_destroy(lv2h_rec_t *rec) {
+    if (rec->fd >= 0) close(rec->fd);
+    if (rec->ring) free(rec->ring);
+    if (rec->chunk) free(rec->chunk);
+    free(rec);
+    return LV2H_OK;
+}
@@ -0,0 +1,150 @@
+#include "lv2h.h"
+#include <errno.h>
+#include <sched.h>
+#include <malloc.h>
+#include <sys/mman.h>
+#if defined(__SSE__) || defined(__x86_64__)
+#include <xmmintrin.h>
+#endif
+
+#define LV2H_RT_STACK_PREFAULT (256 * 1024)
+
+static int lv2h_rt_set_denormals_off(void);
+static void lv2h_rt_prefault_stack(void);
+
+static const char *lv2h_rt_thread_names[LV2H_THREAD_COUNT] = { "audio", "worker", "sched", "midi" };
+
+static __thread int lv2h_rt_thread_role = -1;
+
+int lv2h_set_rt_config(lv2h_t *host, int thread_role, int priority, int cpu, int denormals_off) {
+    lv2h_rt_config_t *config;
+    if (thread_role < 0 || thread_role >= LV2H_THREAD_COUNT) {
+        LV2H_RETURN_ERR(host, "lv2h_set_rt_config: invalid thread_role %d\n", thread_role);
+    }
+    if (priority != 0 && (priority < sched_get_priority_min(SCHED_FIFO) || priority > sched_get_priority_max(SCHED_FIFO))) {
+        LV2H_RETURN_ERR(host, "lv2h_set_rt_config: invalid SCHED_FIFO priority %d\n", priority);
+    }
+    config = &host->rt_config[thread_role];
+    config->priority = priority;
+    config->cpu = cpu;
+    config->denormals_off = denormals_off;
+    return LV2H_OK;
+}
+
+int lv2h_get_rt_result(lv2h_t *host, int thread_role, lv2h_rt_result_t *out_result) {
+    if (thread_role < 0 || thread_role >= LV2H_THREAD_COUNT) {
+        LV2H_RETURN_ERR(host, "lv2h_get_rt_result: invalid thread_role %d\n", thread_role);
+    }
+    *out_result = host->rt_result[thread_role];
+    return LV2H_OK;
+}
+
+int lv2h_lock_memory(lv2h_t *host, size_t prefault_bytes) {
+    char *heap;
+    long page_size;
+    size_t i;
+
+    // Keep freed heap memory mapped so that the prefaulted pages are reused
+    // instead of being trimmed and faulted back in on the audio thread.
+    mallopt(M_TRIM_THRESHOLD, -1);
+    mallopt(M_MMAP_MAX, 0);
+
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+        host->rt_mlock_err = errno;
+        LV2H_RETURN_ERR(host, "lv2h_lock_memory: mlockall: %s\n", strerror(errno));
+    }
+    host->rt_mlock_err = 0;
+
+    if (prefault_bytes > 0) {
+        page_size = sysconf(_SC_PAGESIZE);
+        if (!(heap = malloc(prefault_bytes))) {
+            LV2H_RETURN_ERR(host, "lv2h_lock_memory: could not prefault %lu bytes\n", (unsigned long)prefault_bytes);
+        }
+        for (i = 0; i < prefault_bytes; i += page_size) {
+            heap[i] = 0;
+        }
+        free(heap);
+    }
+    host->rt_locked_bytes = prefault_bytes;
+
+    return LV2H_OK;
+}
+
+int lv2h_rt_enter_thread(lv2h_t *host, int thread_role) {
+    lv2h_rt_config_t *config;
+    lv2h_rt_result_t *result;
+    struct sched_param param;
+    cpu_set_t cpuset;
+    int err;
+
+    if (lv2h_rt_thread_role == thread_role) {
+        return LV2H_OK;
+    }
+    lv2h_rt_thread_role = thread_role;
+
+    config = &host->rt_config[thread_role];
+    result = &host->rt_result[thread_role];
+    memset(result, 0, sizeof(lv2h_rt_result_t));
+    result->cpu = -1;
+
+    if (config->priority > 0) {
+        param.sched_priority = config->priority;
+        if ((err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param)) == 0) {
+            result->priority = config->priority;
+        } else {
+            result->sched_err = err;
+        }
+    }
+
+    if (config->cpu >= 0) {
+        CPU_ZERO(&cpuset);
+        CPU_SET(config->cpu, &cpuset);
+        if ((err = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuset)) == 0) {
+            result->cpu = config->cpu;
+        } else {
+            result->affinity_err = err;
+        }
+    }
+
+    if (config->denormals_off) {
+        result->denormals_off = lv2h_rt_set_denormals_off();
+    }
+
+    if (host->rt_locked_bytes > 0) {
+        lv2h_rt_prefault_stack();
+    }
+
+    lv2h_log_register_thread(host);
+    lv2h_trace_register_thread(host, lv2h_rt_thread_names[thread_role]);
+
+    if (thread_role == LV2H_THREAD_AUDIO || thread_role == LV2H_THREAD_WORKER) {
+        lv2h_rtcheck_register_thread();
+    }
+
+    result->applied = 1;
+    return LV2H_OK;
+}
+
+static int lv2h_rt_set_denormals_off(void) {
+#if defined(__SSE__) || defined(__x86_64__)
+    // FTZ (bit 15) and DAZ (bit 6)
+    _mm_setcsr(_mm_getcsr() | 0x8040);
+    return 1;
+#elif defined(__aarch64__)
+    uint64_t fpcr;
+    // FZ (bit 24)
+    __asm__ __volatile__("mrs %0, fpcr" : "=r"(fpcr));
+    __asm__ __volatile__("msr fpcr, %0" : : "r"(fpcr | (1UL << 24)));
+    return 1;
+#else
+    return 0;
+#endif
+}
+
+static void lv2h_rt_prefault_stack(void) {
+    volatile char stack[LV2H_RT_STACK_PREFAULT];
+    size_t i;
+    for (i = 0; i < sizeof(stack); i += 4096) {
+        stack[i] = 0;
+    }
+}
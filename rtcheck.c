@@ -0,0 +1,231 @@
+#include "lv2h.h"
+
+#ifdef LV2H_RTCHECK
+
+#include <dlfcn.h>
+#include <execinfo.h>
+#include <stdarg.h>
+
+// Debug build only (make rtcheck=1). Interposes allocation and blocking
+// calls and reports any made by a realtime thread while it is processing a
+// block. Set LV2H_RTCHECK_ABORT=1 to abort on the first violation.
+
+#define LV2H_RTCHECK_BOOTSTRAP_SIZE 4096
+#define LV2H_RTCHECK_BACKTRACE_DEPTH 32
+
+#define LV2H_RTCHECK_REAL(name) do {                                        \
+    if (!real_##name) {                                                     \
+        lv2h_rtcheck_in_dlsym = 1;                                          \
+        *(void**)(&real_##name) = dlsym(RTLD_NEXT, #name);                  \
+        lv2h_rtcheck_in_dlsym = 0;                                          \
+    }                                                                       \
+} while (0)
+
+static void lv2h_rtcheck_violation(const char *fn_name);
+static int lv2h_rtcheck_is_bootstrap(void *ptr);
+
+static void *(*real_malloc)(size_t);
+static void *(*real_calloc)(size_t, size_t);
+static void *(*real_realloc)(void *, size_t);
+static void (*real_free)(void *);
+static int (*real_posix_memalign)(void **, size_t, size_t);
+static void *(*real_aligned_alloc)(size_t, size_t);
+static int (*real_pthread_mutex_lock)(pthread_mutex_t *);
+static int (*real_pthread_cond_wait)(pthread_cond_t *, pthread_mutex_t *);
+static int (*real_nanosleep)(const struct timespec *, struct timespec *);
+static int (*real_usleep)(useconds_t);
+static ssize_t (*real_write)(int, const void *, size_t);
+static ssize_t (*real_read)(int, void *, size_t);
+static int (*real_vprintf)(const char *, va_list);
+static int (*real_vfprintf)(FILE *, const char *, va_list);
+static int (*real_puts)(const char *);
+static size_t (*real_fwrite)(const void *, size_t, size_t, FILE *);
+
+static __thread int lv2h_rtcheck_is_rt = 0;
+static __thread int lv2h_rtcheck_in_block = 0;
+static __thread int lv2h_rtcheck_in_report = 0;
+static __thread int lv2h_rtcheck_in_dlsym = 0;
+static int lv2h_rtcheck_abort = 0;
+static unsigned long lv2h_rtcheck_violation_count = 0;
+static char lv2h_rtcheck_bootstrap[LV2H_RTCHECK_BOOTSTRAP_SIZE];
+static size_t lv2h_rtcheck_bootstrap_used = 0;
+
+#define LV2H_RTCHECK_GUARD(name) do {                                       \
+    if (lv2h_rtcheck_in_block && !lv2h_rtcheck_in_report) {                 \
+        lv2h_rtcheck_violation(name);                                       \
+    }                                                                       \
+} while (0)
+
+void lv2h_rtcheck_register_thread(void) {
+    void *frames[1];
+    char *env;
+    // Prime backtrace() so its lazy libgcc load does not allocate later
+    backtrace(frames, 1);
+    if ((env = getenv("LV2H_RTCHECK_ABORT")) && *env == '1') {
+        lv2h_rtcheck_abort = 1;
+    }
+    lv2h_rtcheck_is_rt = 1;
+}
+
+void lv2h_rtcheck_block_begin(void) {
+    lv2h_rtcheck_in_block = lv2h_rtcheck_is_rt;
+}
+
+void lv2h_rtcheck_block_end(void) {
+    lv2h_rtcheck_in_block = 0;
+}
+
+unsigned long lv2h_rtcheck_violations(void) {
+    return __sync_fetch_and_add(&lv2h_rtcheck_violation_count, 0);
+}
+
+void *malloc(size_t size) {
+    void *ptr;
+    if (lv2h_rtcheck_in_dlsym) {
+        size = (size + 15) & ~(size_t)15;
+        if (lv2h_rtcheck_bootstrap_used + size > LV2H_RTCHECK_BOOTSTRAP_SIZE) return NULL;
+        ptr = lv2h_rtcheck_bootstrap + lv2h_rtcheck_bootstrap_used;
+        lv2h_rtcheck_bootstrap_used += size;
+        return ptr;
+    }
+    LV2H_RTCHECK_GUARD("malloc");
+    LV2H_RTCHECK_REAL(malloc);
+    return real_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size) {
+    if (lv2h_rtcheck_in_dlsym) {
+        // Bootstrap memory is static, hence already zeroed
+        return malloc(nmemb * size);
+    }
+    LV2H_RTCHECK_GUARD("calloc");
+    LV2H_RTCHECK_REAL(calloc);
+    return real_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+    LV2H_RTCHECK_GUARD("realloc");
+    LV2H_RTCHECK_REAL(realloc);
+    return real_realloc(ptr, size);
+}
+
+void free(void *ptr) {
+    if (lv2h_rtcheck_is_bootstrap(ptr)) return;
+    LV2H_RTCHECK_GUARD("free");
+    LV2H_RTCHECK_REAL(free);
+    real_free(ptr);
+}
+
+int posix_memalign(void **memptr, size_t alignment, size_t size) {
+    LV2H_RTCHECK_GUARD("posix_memalign");
+    LV2H_RTCHECK_REAL(posix_memalign);
+    return real_posix_memalign(memptr, alignment, size);
+}
+
+void *aligned_alloc(size_t alignment, size_t size) {
+    LV2H_RTCHECK_GUARD("aligned_alloc");
+    LV2H_RTCHECK_REAL(aligned_alloc);
+    return real_aligned_alloc(alignment, size);
+}
+
+int pthread_mutex_lock(pthread_mutex_t *mutex) {
+    LV2H_RTCHECK_GUARD("pthread_mutex_lock");
+    LV2H_RTCHECK_REAL(pthread_mutex_lock);
+    return real_pthread_mutex_lock(mutex);
+}
+
+int pthread_cond_wait(pthread_cond_t *cond, pthread_mutex_t *mutex) {
+    LV2H_RTCHECK_GUARD("pthread_cond_wait");
+    LV2H_RTCHECK_REAL(pthread_cond_wait);
+    return real_pthread_cond_wait(cond, mutex);
+}
+
+int nanosleep(const struct timespec *req, struct timespec *rem) {
+    LV2H_RTCHECK_GUARD("nanosleep");
+    LV2H_RTCHECK_REAL(nanosleep);
+    return real_nanosleep(req, rem);
+}
+
+int usleep(useconds_t usec) {
+    LV2H_RTCHECK_GUARD("usleep");
+    LV2H_RTCHECK_REAL(usleep);
+    return real_usleep(usec);
+}
+
+ssize_t write(int fd, const void *buf, size_t count) {
+    LV2H_RTCHECK_GUARD("write");
+    LV2H_RTCHECK_REAL(write);
+    return real_write(fd, buf, count);
+}
+
+ssize_t read(int fd, void *buf, size_t count) {
+    LV2H_RTCHECK_GUARD("read");
+    LV2H_RTCHECK_REAL(read);
+    return real_read(fd, buf, count);
+}
+
+int printf(const char *format, ...) {
+    va_list ap;
+    int rv;
+    LV2H_RTCHECK_GUARD("printf");
+    LV2H_RTCHECK_REAL(vprintf);
+    va_start(ap, format);
+    rv = real_vprintf(format, ap);
+    va_end(ap);
+    return rv;
+}
+
+int fprintf(FILE *stream, const char *format, ...) {
+    va_list ap;
+    int rv;
+    LV2H_RTCHECK_GUARD("fprintf");
+    LV2H_RTCHECK_REAL(vfprintf);
+    va_start(ap, format);
+    rv = real_vfprintf(stream, format, ap);
+    va_end(ap);
+    return rv;
+}
+
+int puts(const char *s) {
+    LV2H_RTCHECK_GUARD("puts");
+    LV2H_RTCHECK_REAL(puts);
+    return real_puts(s);
+}
+
+size_t fwrite(const void *ptr, size_t size, size_t nmemb, FILE *stream) {
+    LV2H_RTCHECK_GUARD("fwrite");
+    LV2H_RTCHECK_REAL(fwrite);
+    return real_fwrite(ptr, size, nmemb, stream);
+}
+
+static void lv2h_rtcheck_violation(const char *fn_name) {
+    void *frames[LV2H_RTCHECK_BACKTRACE_DEPTH];
+    char msg[128];
+    int frame_count;
+    int len;
+
+    lv2h_rtcheck_in_report = 1;
+    __sync_fetch_and_add(&lv2h_rtcheck_violation_count, 1);
+
+    LV2H_RTCHECK_REAL(write);
+    len = snprintf(msg, sizeof(msg), "rtcheck: %s called from realtime thread during block\n", fn_name);
+    real_write(STDERR_FILENO, msg, len);
+    frame_count = backtrace(frames, LV2H_RTCHECK_BACKTRACE_DEPTH);
+    backtrace_symbols_fd(frames, frame_count, STDERR_FILENO);
+
+    if (lv2h_rtcheck_abort) {
+        abort();
+    }
+    lv2h_rtcheck_in_report = 0;
+}
+
+static int lv2h_rtcheck_is_bootstrap(void *ptr) {
+    return (char*)ptr >= lv2h_rtcheck_bootstrap
+        && (char*)ptr < lv2h_rtcheck_bootstrap + LV2H_RTCHECK_BOOTSTRAP_SIZE;
+}
+
+#else
+
+typedef int lv2h_rtcheck_disabled_t;
+
+#endif
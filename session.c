@@ -0,0 +1,508 @@
+#include "lv2h.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <lv2/lv2plug.in/ns/ext/state/state.h>
+
+#define LV2H_SESSION_MAGIC "LV2HSESS"
+#define LV2H_SESSION_VERSION 1
+#define LV2H_SESSION_AUDIO_INST 0xffffffffU
+#define LV2H_SESSION_INPUT_INST 0xfffffffeU
+#define LV2H_SESSION_NO_PARENT 0xffffffffU
+#define LV2H_SESSION_STATE_URI "urn:lv2h:session:state"
+
+typedef struct _lv2h_session_writer_t lv2h_session_writer_t;
+typedef struct _lv2h_session_reader_t lv2h_session_reader_t;
+typedef struct _lv2h_session_header_t lv2h_session_header_t;
+typedef struct _lv2h_session_inst_t lv2h_session_inst_t;
+typedef struct _lv2h_session_node_t lv2h_session_node_t;
+typedef struct _lv2h_session_conn_t lv2h_session_conn_t;
+
+// On-disk records are native endian and packed by hand
+
+struct _lv2h_session_header_t {
+    char magic[8];
+    uint32_t version;
+    uint32_t sample_rate;
+    uint32_t plug_count;
+    uint32_t inst_count;
+    uint32_t conn_count;
+    uint32_t node_count;
+};
+
+struct _lv2h_session_conn_t {
+    uint32_t writer_inst;
+    uint32_t writer_port;
+    uint32_t reader_inst;
+    uint32_t reader_port;
+};
+
+struct _lv2h_session_node_t {
+    uint32_t parent;
+    int32_t count_limit;
+    int32_t count;
+    int64_t offset_ns;
+    int64_t interval_ns;
+    int64_t divisor;
+    int64_t multiplier;
+    double interval_factor;
+};
+
+struct _lv2h_session_writer_t {
+    FILE *fp;
+    int err;
+};
+
+struct _lv2h_session_reader_t {
+    lv2h_t *host;
+    const char *data;
+    size_t size;
+    size_t pos;
+};
+
+struct _lv2h_session_inst_t {
+    uint32_t plug_index;
+    lv2h_plug_t *plug;
+    LilvInstance *lilv_inst;
+    const char *control_vals;
+    uint32_t port_count;
+    int64_t tail_frames;
+    const char *state_str;
+};
+
+static void lv2h_session_write(lv2h_session_writer_t *writer, const void *data, size_t len);
+static void lv2h_session_write_str(lv2h_session_writer_t *writer, const char *str);
+static int lv2h_session_write_inst(lv2h_t *host, lv2h_session_writer_t *writer, lv2h_inst_t *inst, uint32_t plug_index);
+static void lv2h_session_write_nodes(lv2h_session_writer_t *writer, lv2h_node_t *node, uint32_t parent, uint32_t *node_index);
+static uint32_t lv2h_session_count_nodes(lv2h_node_t *node);
+static uint32_t lv2h_session_inst_index(lv2h_t *host, lv2h_inst_t *inst);
+static int lv2h_session_read(lv2h_session_reader_t *reader, void *out, size_t len);
+static int lv2h_session_read_str(lv2h_session_reader_t *reader, const char **out_str);
+static int lv2h_session_instantiate(lv2h_session_inst_t *sinst_array, uint32_t inst_count, double sample_rate, const LV2_Feature *const *features);
+static int lv2h_session_check_end(lv2h_t *host, lv2h_session_inst_t *sinst_array, uint32_t inst_count, uint32_t index, uint32_t port_index);
+static lv2h_inst_t *lv2h_session_find_inst(lv2h_t *host, lv2h_inst_t **inst_array, uint32_t inst_count, uint32_t index);
+
+int lv2h_session_save(lv2h_t *host, char *path) {
+    lv2h_session_writer_t writer;
+    lv2h_session_header_t header;
+    lv2h_session_conn_t conn_rec;
+    lv2h_plug_t *plug, *plug_tmp;
+    lv2h_inst_t *inst;
+    lv2h_port_t *port;
+    lv2h_conn_t *conn;
+    lv2h_node_t *node;
+    char tmp_path[PATH_MAX];
+    uint32_t plug_index, node_index;
+    uint32_t p;
+
+    // Number plugins and instances in hash order. Connections refer to
+    // instances by index.
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, LV2H_SESSION_MAGIC, sizeof(header.magic));
+    header.version = LV2H_SESSION_VERSION;
+    header.sample_rate = host->sample_rate;
+    HASH_ITER(hh, host->plugin_map, plug, plug_tmp) {
+        header.plug_count += 1;
+        LL_FOREACH(plug->inst_list, inst) {
+            inst->session_index = header.inst_count++;
+            for (p = 0; p < plug->port_count; ++p) {
+                LL_FOREACH(inst->port_array[p].conn_list, conn) header.conn_count += 1;
+            }
+        }
+    }
+    for (p = 0; p < host->audio_plug->port_count; ++p) {
+        LL_FOREACH(host->audio_inst->port_array[p].conn_list, conn) header.conn_count += 1;
+    }
+    LL_FOREACH2(host->parent_node_list, node, next_parent) {
+        header.node_count += lv2h_session_count_nodes(node);
+    }
+
+    // Write to a temp file and rename so a crash never leaves half a session
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    if (!(writer.fp = fopen(tmp_path, "wb"))) {
+        LV2H_RETURN_ERR(host, "lv2h_session_save: could not open %s.tmp: %s\n", path, strerror(errno));
+    }
+    writer.err = 0;
+    lv2h_session_write(&writer, &header, sizeof(header));
+
+    HASH_ITER(hh, host->plugin_map, plug, plug_tmp) {
+        lv2h_session_write_str(&writer, plug->uri_str);
+    }
+
+    plug_index = 0;
+    HASH_ITER(hh, host->plugin_map, plug, plug_tmp) {
+        LL_FOREACH(plug->inst_list, inst) {
+            if (lv2h_session_write_inst(host, &writer, inst, plug_index) != LV2H_OK) {
+                fclose(writer.fp);
+                unlink(tmp_path);
+                return LV2H_ERR;
+            }
+        }
+        plug_index += 1;
+    }
+
+    // Connections, keyed by reader port
+    HASH_ITER(hh, host->plugin_map, plug, plug_tmp) {
+        LL_FOREACH(plug->inst_list, inst) {
+            for (p = 0; p < plug->port_count; ++p) {
+                port = inst->port_array + p;
+                LL_FOREACH(port->conn_list, conn) {
+                    conn_rec.writer_inst = lv2h_session_inst_index(host, conn->writer_port->inst);
+                    conn_rec.writer_port = conn->writer_port->port_index;
+                    conn_rec.reader_inst = inst->session_index;
+                    conn_rec.reader_port = p;
+                    lv2h_session_write(&writer, &conn_rec, sizeof(conn_rec));
+                }
+            }
+        }
+    }
+    for (p = 0; p < host->audio_plug->port_count; ++p) {
+        LL_FOREACH(host->audio_inst->port_array[p].conn_list, conn) {
+            conn_rec.writer_inst = lv2h_session_inst_index(host, conn->writer_port->inst);
+            conn_rec.writer_port = conn->writer_port->port_index;
+            conn_rec.reader_inst = LV2H_SESSION_AUDIO_INST;
+            conn_rec.reader_port = p;
+            lv2h_session_write(&writer, &conn_rec, sizeof(conn_rec));
+        }
+    }
+
+    // Node tree, parents before children
+    node_index = 0;
+    LL_FOREACH2(host->parent_node_list, node, next_parent) {
+        lv2h_session_write_nodes(&writer, node, LV2H_SESSION_NO_PARENT, &node_index);
+    }
+
+    if (fclose(writer.fp) != 0) writer.err = 1;
+    if (writer.err || rename(tmp_path, path) != 0) {
+        unlink(tmp_path);
+        LV2H_RETURN_ERR(host, "lv2h_session_save: could not write %s: %s\n", path, strerror(errno));
+    }
+    return LV2H_OK;
+}
+
+int lv2h_session_load(lv2h_t *host, char *path, lv2h_node_t ***out_node_array, uint32_t *out_node_count) {
+    lv2h_session_reader_t reader;
+    lv2h_session_header_t header;
+    lv2h_session_conn_t conn_rec;
+    lv2h_session_node_t node_rec;
+    lv2h_session_inst_t *sinst_array;
+    lv2h_session_inst_t *sinst;
+    lv2h_plug_t **plug_array;
+    lv2h_plug_t *plug;
+    lv2h_inst_t **inst_array;
+    lv2h_inst_t *writer_inst, *reader_inst;
+    lv2h_node_t **node_array;
+    lv2h_node_t *node;
+    LilvState *state;
+    struct stat st;
+    const char **uri_array;
+    uint8_t *plug_is_new;
+    void *map;
+    size_t conn_pos, node_pos;
+    uint32_t i, p;
+    int fd;
+    int rv;
+
+    if ((fd = open(path, O_RDONLY)) < 0) {
+        LV2H_RETURN_ERR(host, "lv2h_session_load: could not open %s: %s\n", path, strerror(errno));
+    }
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(header)) {
+        close(fd);
+        LV2H_RETURN_ERR(host, "lv2h_session_load: %s is not a session\n", path);
+    }
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        LV2H_RETURN_ERR(host, "lv2h_session_load: mmap: %s\n", strerror(errno));
+    }
+
+    reader.host = host;
+    reader.data = (const char*)map;
+    reader.size = st.st_size;
+    reader.pos = 0;
+
+    uri_array = NULL;
+    plug_array = NULL;
+    plug_is_new = NULL;
+    sinst_array = NULL;
+    inst_array = NULL;
+    node_array = NULL;
+    rv = LV2H_ERR;
+
+    lv2h_session_read(&reader, &header, sizeof(header));
+    if (memcmp(header.magic, LV2H_SESSION_MAGIC, sizeof(header.magic)) != 0) {
+        snprintf(host->errstr, sizeof(host->errstr), "lv2h_session_load: %s is not a session\n", path);
+        goto lv2h_session_load_done;
+    }
+    if (header.version != LV2H_SESSION_VERSION) {
+        snprintf(host->errstr, sizeof(host->errstr), "lv2h_session_load: unsupported version %u\n", header.version);
+        goto lv2h_session_load_done;
+    }
+
+    uri_array = calloc(header.plug_count + 1, sizeof(char*));
+    plug_array = calloc(header.plug_count + 1, sizeof(lv2h_plug_t*));
+    plug_is_new = calloc(header.plug_count + 1, sizeof(uint8_t));
+    sinst_array = calloc(header.inst_count + 1, sizeof(lv2h_session_inst_t));
+    inst_array = calloc(header.inst_count + 1, sizeof(lv2h_inst_t*));
+    node_array = calloc(header.node_count + 1, sizeof(lv2h_node_t*));
+
+    // Parse and check the whole file before touching the host, so most
+    // bad sessions fail with nothing to undo
+    for (i = 0; i < header.plug_count; ++i) {
+        if (lv2h_session_read_str(&reader, uri_array + i) != LV2H_OK) goto lv2h_session_load_done;
+    }
+    for (i = 0; i < header.inst_count; ++i) {
+        sinst = sinst_array + i;
+        if (lv2h_session_read(&reader, &sinst->plug_index, sizeof(sinst->plug_index)) != LV2H_OK) goto lv2h_session_load_done;
+        if (lv2h_session_read(&reader, &sinst->port_count, sizeof(sinst->port_count)) != LV2H_OK) goto lv2h_session_load_done;
+        if (sinst->plug_index >= header.plug_count) {
+            snprintf(host->errstr, sizeof(host->errstr), "lv2h_session_load: instance %u has no plugin\n", i);
+            goto lv2h_session_load_done;
+        }
+        sinst->control_vals = reader.data + reader.pos;
+        if (lv2h_session_read(&reader, NULL, sinst->port_count * sizeof(float)) != LV2H_OK) goto lv2h_session_load_done;
+        if (lv2h_session_read(&reader, &sinst->tail_frames, sizeof(sinst->tail_frames)) != LV2H_OK) goto lv2h_session_load_done;
+        if (lv2h_session_read_str(&reader, &sinst->state_str) != LV2H_OK) goto lv2h_session_load_done;
+    }
+    conn_pos = reader.pos;
+    for (i = 0; i < header.conn_count; ++i) {
+        if (lv2h_session_read(&reader, &conn_rec, sizeof(conn_rec)) != LV2H_OK) goto lv2h_session_load_done;
+        if (lv2h_session_check_end(host, sinst_array, header.inst_count, conn_rec.writer_inst, conn_rec.writer_port) != LV2H_OK
+            || lv2h_session_check_end(host, sinst_array, header.inst_count, conn_rec.reader_inst, conn_rec.reader_port) != LV2H_OK
+        ) {
+            snprintf(host->errstr, sizeof(host->errstr), "lv2h_session_load: connection %u is invalid\n", i);
+            goto lv2h_session_load_done;
+        }
+    }
+    node_pos = reader.pos;
+    if (lv2h_session_read(&reader, NULL, header.node_count * sizeof(node_rec)) != LV2H_OK) goto lv2h_session_load_done;
+
+    // Only plugins this load adds are freed again on failure
+    for (i = 0; i < header.plug_count; ++i) {
+        HASH_FIND_STR(host->plugin_map, uri_array[i], plug);
+        if (lv2h_plug_new(host, (char*)uri_array[i], plug_array + i) != LV2H_OK) goto lv2h_session_load_done;
+        plug_is_new[i] = !plug;
+    }
+    for (i = 0; i < header.inst_count; ++i) {
+        sinst = sinst_array + i;
+        sinst->plug = plug_array[sinst->plug_index];
+        if (sinst->port_count != sinst->plug->port_count) {
+            snprintf(host->errstr, sizeof(host->errstr), "lv2h_session_load: instance %u does not match its plugin\n", i);
+            goto lv2h_session_load_done;
+        }
+    }
+
+    if (lv2h_session_instantiate(sinst_array, header.inst_count, (double)host->sample_rate, host->features) != LV2H_OK) {
+        snprintf(host->errstr, sizeof(host->errstr), "lv2h_session_load: could not instantiate all plugins\n");
+        goto lv2h_session_load_done;
+    }
+
+    for (i = 0; i < header.inst_count; ++i) {
+        sinst = sinst_array + i;
+        if (lv2h_inst_init(sinst->plug, sinst->lilv_inst, inst_array + i) != LV2H_OK) goto lv2h_session_load_done;
+        sinst->lilv_inst = NULL;
+        for (p = 0; p < sinst->port_count; ++p) {
+            if (inst_array[i]->port_array[p].is_control) {
+                memcpy(&inst_array[i]->port_array[p].control_val, sinst->control_vals + p * sizeof(float), sizeof(float));
+            }
+        }
+        inst_array[i]->tail_frames = (long)sinst->tail_frames;
+        if (*sinst->state_str) {
+            if ((state = lilv_state_new_from_string(host->lilv_world, &host->urid_map, sinst->state_str))) {
+                lilv_state_restore(state, inst_array[i]->lilv_inst, NULL, NULL, 0, host->features);
+                lilv_state_free(state);
+            }
+        }
+    }
+
+    // Link everything, then compile the graph once
+    for (i = 0; i < header.conn_count; ++i) {
+        memcpy(&conn_rec, reader.data + conn_pos + i * sizeof(conn_rec), sizeof(conn_rec));
+        writer_inst = lv2h_session_find_inst(host, inst_array, header.inst_count, conn_rec.writer_inst);
+        reader_inst = lv2h_session_find_inst(host, inst_array, header.inst_count, conn_rec.reader_inst);
+        if (lv2h_port_xnnect(writer_inst->port_array + conn_rec.writer_port, reader_inst->port_array + conn_rec.reader_port, 0, 0) != LV2H_OK) {
+            goto lv2h_session_load_done;
+        }
+    }
+    lv2h_graph_compile(host);
+
+    // Callbacks cannot be saved. Restored nodes do nothing until bound
+    // with lv2h_node_set_callback.
+    for (i = 0; i < header.node_count; ++i) {
+        memcpy(&node_rec, reader.data + node_pos + i * sizeof(node_rec), sizeof(node_rec));
+        lv2h_node_new(host, NULL, NULL, &node);
+        node->offset_ns = (long)node_rec.offset_ns;
+        node->interval_ns = (long)node_rec.interval_ns;
+        node->interval_ns_double = (double)node->interval_ns;
+        node->interval_factor = node_rec.interval_factor;
+        node->count_limit = node_rec.count_limit;
+        node->count = node_rec.count;
+        node->divisor = (long)node_rec.divisor;
+        node->multiplier = (long)node_rec.multiplier;
+        if (node_rec.parent != LV2H_SESSION_NO_PARENT && node_rec.parent < i) {
+            lv2h_node_follow(node, node_array[node_rec.parent]);
+        }
+        node_array[i] = node;
+    }
+
+    rv = LV2H_OK;
+
+lv2h_session_load_done:
+    if (rv != LV2H_OK) {
+        // Leave the host as it was. Freeing an instance also drops its
+        // connections.
+        for (i = 0; inst_array && i < header.inst_count; ++i) {
+            if (inst_array[i]) lv2h_inst_free(inst_array[i]);
+        }
+        for (i = 0; plug_is_new && i < header.plug_count; ++i) {
+            if (plug_is_new[i]) lv2h_plug_free(plug_array[i]);
+        }
+    }
+    if (sinst_array) {
+        for (i = 0; i < header.inst_count; ++i) {
+            if (sinst_array[i].lilv_inst) lilv_instance_free(sinst_array[i].lilv_inst);
+        }
+        free(sinst_array);
+    }
+    if (uri_array) free(uri_array);
+    if (plug_array) free(plug_array);
+    if (plug_is_new) free(plug_is_new);
+    if (inst_array) free(inst_array);
+    if (rv == LV2H_OK && out_node_array) {
+        *out_node_array = node_array;
+        *out_node_count = header.node_count;
+    } else if (node_array) {
+        free(node_array);
+    }
+    munmap(map, st.st_size);
+    return rv;
+}
+
+static void lv2h_session_write(lv2h_session_writer_t *writer, const void *data, size_t len) {
+    if (len > 0 && fwrite(data, 1, len, writer->fp) != len) {
+        writer->err = 1;
+    }
+}
+
+static void lv2h_session_write_str(lv2h_session_writer_t *writer, const char *str) {
+    uint32_t len;
+    // Length includes the NUL so strings can be used straight from the map
+    len = (uint32_t)strlen(str) + 1;
+    lv2h_session_write(writer, &len, sizeof(len));
+    lv2h_session_write(writer, str, len);
+}
+
+static int lv2h_session_write_inst(lv2h_t *host, lv2h_session_writer_t *writer, lv2h_inst_t *inst, uint32_t plug_index) {
+    LilvState *state;
+    char *state_str;
+    int64_t tail_frames;
+    uint32_t p;
+
+    lv2h_session_write(writer, &plug_index, sizeof(plug_index));
+    lv2h_session_write(writer, &inst->plug->port_count, sizeof(inst->plug->port_count));
+    for (p = 0; p < inst->plug->port_count; ++p) {
+        lv2h_session_write(writer, &inst->port_array[p].control_val, sizeof(float));
+    }
+    tail_frames = inst->tail_frames;
+    lv2h_session_write(writer, &tail_frames, sizeof(tail_frames));
+
+    // Port values are already saved above, so only plugin state goes here
+    state_str = NULL;
+    if (inst->lilv_inst && lilv_instance_get_extension_data(inst->lilv_inst, LV2_STATE__interface)) {
+        state = lilv_state_new_from_instance(inst->plug->lilv_plugin, inst->lilv_inst, &host->urid_map, NULL, NULL, NULL, NULL, NULL, NULL, 0, host->features);
+        if (!state) {
+            LV2H_RETURN_ERR(host, "lv2h_session_save: could not save state of %s\n", inst->plug->uri_str);
+        }
+        state_str = lilv_state_to_string(host->lilv_world, &host->urid_map, &host->urid_unmap, state, LV2H_SESSION_STATE_URI, NULL);
+        lilv_state_free(state);
+    }
+    lv2h_session_write_str(writer, state_str ? state_str : "");
+    if (state_str) free(state_str);
+    return LV2H_OK;
+}
+
+static void lv2h_session_write_nodes(lv2h_session_writer_t *writer, lv2h_node_t *node, uint32_t parent, uint32_t *node_index) {
+    lv2h_session_node_t node_rec;
+    lv2h_node_t *child;
+    uint32_t index;
+
+    memset(&node_rec, 0, sizeof(node_rec));
+    node_rec.parent = parent;
+    node_rec.count_limit = node->count_limit;
+    node_rec.count = node->count;
+    node_rec.offset_ns = node->offset_ns;
+    node_rec.interval_ns = node->interval_ns;
+    node_rec.divisor = node->divisor;
+    node_rec.multiplier = node->multiplier;
+    node_rec.interval_factor = node->interval_factor;
+    lv2h_session_write(writer, &node_rec, sizeof(node_rec));
+
+    index = (*node_index)++;
+    LL_FOREACH2(node->child_list, child, next_child) {
+        lv2h_session_write_nodes(writer, child, index, node_index);
+    }
+}
+
+static uint32_t lv2h_session_count_nodes(lv2h_node_t *node) {
+    lv2h_node_t *child;
+    uint32_t count;
+    count = 1;
+    LL_FOREACH2(node->child_list, child, next_child) {
+        count += lv2h_session_count_nodes(child);
+    }
+    return count;
+}
+
+static uint32_t lv2h_session_inst_index(lv2h_t *host, lv2h_inst_t *inst) {
+    if (inst == host->audio_inst) return LV2H_SESSION_AUDIO_INST;
+    if (inst == host->input_inst) return LV2H_SESSION_INPUT_INST;
+    return inst->session_index;
+}
+
+static lv2h_inst_t *lv2h_session_find_inst(lv2h_t *host, lv2h_inst_t **inst_array, uint32_t inst_count, uint32_t index) {
+    if (index == LV2H_SESSION_AUDIO_INST) return host->audio_inst;
+    if (index == LV2H_SESSION_INPUT_INST) return host->input_inst; // NULL without lv2h_set_audio_input
+    return index < inst_count ? inst_array[index] : NULL;
+}
+
+static int lv2h_session_read(lv2h_session_reader_t *reader, void *out, size_t len) {
+    if (reader->size - reader->pos < len) {
+        LV2H_RETURN_ERR(reader->host, "lv2h_session_load: truncated at offset %zu\n", reader->pos);
+    }
+    if (out) memcpy(out, reader->data + reader->pos, len);
+    reader->pos += len;
+    return LV2H_OK;
+}
+
+static int lv2h_session_read_str(lv2h_session_reader_t *reader, const char **out_str) {
+    uint32_t len;
+    const char *str;
+    if (lv2h_session_read(reader, &len, sizeof(len)) != LV2H_OK) return LV2H_ERR;
+    str = reader->data + reader->pos;
+    if (lv2h_session_read(reader, NULL, len) != LV2H_OK) return LV2H_ERR;
+    if (len < 1 || str[len - 1] != '\0') {
+        LV2H_RETURN_ERR(reader->host, "lv2h_session_load: bad string at offset %zu\n", reader->pos - len);
+    }
+    *out_str = str;
+    return LV2H_OK;
+}
+
+static int lv2h_session_instantiate(lv2h_session_inst_t *sinst_array, uint32_t inst_count, double sample_rate, const LV2_Feature *const *features) {
+    uint32_t i;
+
+    // One at a time. lilv's world and library list are not thread safe,
+    // and plugins map URIs through the host while instantiating.
+    for (i = 0; i < inst_count; ++i) {
+        sinst_array[i].lilv_inst = lilv_plugin_instantiate(sinst_array[i].plug->lilv_plugin, sample_rate, features);
+        if (!sinst_array[i].lilv_inst) return LV2H_ERR;
+    }
+    return LV2H_OK;
+}
+
+static int lv2h_session_check_end(lv2h_t *host, lv2h_session_inst_t *sinst_array, uint32_t inst_count, uint32_t index, uint32_t port_index) {
+    // A connection end must name an instance and a port that will exist
+    if (index == LV2H_SESSION_AUDIO_INST) return port_index < host->audio_plug->port_count ? LV2H_OK : LV2H_ERR;
+    if (index == LV2H_SESSION_INPUT_INST) return host->input_inst && port_index < host->input_plug->port_count ? LV2H_OK : LV2H_ERR;
+    return index < inst_count && port_index < sinst_array[index].port_count ? LV2H_OK : LV2H_ERR;
+}
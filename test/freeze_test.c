@@ -0,0 +1,59 @@
+#include "lv2h.h"
+
+// Freezes the middle of amp -> amp -> out, with and without pruning.
+// Needs the LV2 example plugins; skips when eg-amp is not installed.
+
+#define AMP_URI "http://lv2plug.in/plugins/eg-amp"
+
+static int check_upstream(lv2h_inst_t *inst, void *udata, long frame);
+static int run_case(int prune);
+
+static int check_upstream(lv2h_inst_t *inst, void *udata, long frame) {
+    (void)inst;
+    (void)frame;
+    // The upstream instance is run offline and must stay active
+    return ((lv2h_inst_t*)udata)->is_active ? LV2H_OK : LV2H_ERR;
+}
+
+static int run_case(int prune) {
+    lv2h_t *host;
+    lv2h_plug_t *plug;
+    lv2h_inst_t *inst[2];
+    const char *what;
+
+    if (lv2h_new(44100, 128, 10, &host) != LV2H_OK) {
+        fprintf(stderr, "freeze_test: lv2h_new failed\n");
+        return 1;
+    }
+    if (lv2h_plug_new(host, AMP_URI, &plug) != LV2H_OK) {
+        fprintf(stderr, "freeze_test: %s not installed, skipping\n", AMP_URI);
+        lv2h_free(host);
+        return 77;
+    }
+    lv2h_set_prune(host, prune);
+
+    what = NULL;
+    if (lv2h_inst_new(plug, &inst[0]) != LV2H_OK) what = "inst a";
+    else if (lv2h_inst_new(plug, &inst[1]) != LV2H_OK) what = "inst b";
+    else if (lv2h_inst_connect(inst[0], "out", inst[1], "in") != LV2H_OK) what = "connect a b";
+    else if (lv2h_inst_connect_to_audio(inst[1], "out", 0) != LV2H_OK) what = "connect b out";
+    else if (lv2h_inst_freeze(inst[1], 100, check_upstream, inst[0]) != LV2H_OK) what = "freeze b";
+    else if (!inst[1]->is_frozen || !inst[1]->freeze) what = "b not frozen";
+    else if (lv2h_inst_freeze(inst[1], 100, NULL, NULL) == LV2H_OK) what = "refreeze b";
+    else if (lv2h_inst_unfreeze(inst[1]) != LV2H_OK) what = "unfreeze b";
+
+    if (what) {
+        fprintf(stderr, "freeze_test: prune=%d: %s: %s", prune, what, host->errstr);
+    }
+    lv2h_free(host);
+    return what ? 1 : 0;
+}
+
+int main(void) {
+    int rv;
+    if ((rv = run_case(0)) != 0 || (rv = run_case(1)) != 0) {
+        return rv;
+    }
+    printf("freeze_test: ok\n");
+    return 0;
+}
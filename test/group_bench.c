@@ -0,0 +1,94 @@
+#include "lv2h.h"
+
+// Times blocks of many metro -> amp voices with the schedule grouped by
+// plugin and in plain graph order. Fails if grouping stops ordering copies
+// together or makes blocks clearly slower. Needs the LV2 example plugins;
+// skips when they are not installed.
+
+#define METRO_URI "http://lv2plug.in/plugins/eg-metro"
+#define AMP_URI "http://lv2plug.in/plugins/eg-amp"
+#define VOICES 64
+#define BLOCKS 2000
+#define REPEATS 5
+#define MAX_SLOWDOWN 1.5
+
+static int time_blocks(lv2h_t *host, int group_plugs, double *out_ns);
+static int check_grouped(lv2h_t *host);
+
+static int time_blocks(lv2h_t *host, int group_plugs, double *out_ns) {
+    struct timespec t0, t1;
+    double ns, best_ns;
+    int r, b;
+
+    if (lv2h_set_group_plugs(host, group_plugs) != LV2H_OK) {
+        return LV2H_ERR;
+    }
+
+    // Best of a few runs, after a warm up, to keep noise out
+    best_ns = 0.0;
+    for (r = 0; r <= REPEATS; ++r) {
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        for (b = 0; b < BLOCKS; ++b) {
+            lv2h_process_block(host, host->block_size);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        ns = ((t1.tv_sec - t0.tv_sec) * 1000000000.0 + (t1.tv_nsec - t0.tv_nsec)) / BLOCKS;
+        if (r > 0 && (best_ns == 0.0 || ns < best_ns)) best_ns = ns;
+    }
+    *out_ns = best_ns;
+    return LV2H_OK;
+}
+
+static int check_grouped(lv2h_t *host) {
+    lv2h_sched_t *sched;
+    size_t i, runs;
+
+    // Each plugin should run as one stretch. The audio instance adds one.
+    sched = host->sched;
+    runs = 1;
+    for (i = 1; i < sched->item_count; ++i) {
+        if (sched->item_array[i].inst->plug != sched->item_array[i - 1].inst->plug) runs += 1;
+    }
+    return runs <= 3 ? LV2H_OK : LV2H_ERR;
+}
+
+int main(void) {
+    lv2h_t *host;
+    lv2h_plug_t *metro_plug, *amp_plug;
+    lv2h_inst_t *metro, *amp;
+    double plain_ns, grouped_ns;
+    const char *what;
+    int i;
+
+    if (lv2h_new(48000, 128, 10, &host) != LV2H_OK) {
+        fprintf(stderr, "group_bench: lv2h_new failed\n");
+        return 1;
+    }
+    if (lv2h_plug_new(host, METRO_URI, &metro_plug) != LV2H_OK || lv2h_plug_new(host, AMP_URI, &amp_plug) != LV2H_OK) {
+        fprintf(stderr, "group_bench: example plugins not installed, skipping\n");
+        lv2h_free(host);
+        return 77;
+    }
+
+    what = NULL;
+    for (i = 0; i < VOICES && !what; ++i) {
+        if (lv2h_inst_new(metro_plug, &metro) != LV2H_OK) what = "metro";
+        else if (lv2h_inst_new(amp_plug, &amp) != LV2H_OK) what = "amp";
+        else if (lv2h_inst_connect(metro, "out", amp, "in") != LV2H_OK) what = "connect metro amp";
+        else if (lv2h_inst_connect_to_audio(amp, "out", 0) != LV2H_OK) what = "connect amp out";
+    }
+    if (!what && time_blocks(host, 0, &plain_ns) != LV2H_OK) what = "plain run";
+    else if (!what && time_blocks(host, 1, &grouped_ns) != LV2H_OK) what = "grouped run";
+    else if (!what && check_grouped(host) != LV2H_OK) what = "schedule not grouped";
+
+    if (!what) {
+        printf("group_bench: %d voices, plain %.0f ns/block, grouped %.0f ns/block (%+.1f%%)\n",
+            VOICES, plain_ns, grouped_ns, 100.0 * (grouped_ns - plain_ns) / plain_ns);
+        if (grouped_ns > plain_ns * MAX_SLOWDOWN) what = "grouping made blocks slower";
+    }
+    if (what) {
+        fprintf(stderr, "group_bench: %s: %s", what, host->errstr);
+    }
+    lv2h_free(host);
+    return what ? 1 : 0;
+}
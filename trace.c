@@ -0,0 +1,182 @@
+#include "lv2h.h"
+#include <sys/syscall.h>
+
+static lv2h_trace_ring_t *lv2h_trace_get_ring(lv2h_t *host, const char *thread_name);
+static void lv2h_trace_write_str(FILE *fp, const char *str);
+
+static __thread lv2h_trace_ring_t *lv2h_trace_thread_ring = NULL;
+static __thread lv2h_t *lv2h_trace_thread_host = NULL;
+
+int lv2h_trace_start(lv2h_t *host) {
+    __atomic_store_n(&host->trace_enabled, 1, __ATOMIC_RELEASE);
+    return LV2H_OK;
+}
+
+int lv2h_trace_stop(lv2h_t *host) {
+    __atomic_store_n(&host->trace_enabled, 0, __ATOMIC_RELEASE);
+    return LV2H_OK;
+}
+
+int lv2h_trace_dump_on_xrun(lv2h_t *host, char *path_prefix) {
+    if (host->trace_xrun_prefix) free(host->trace_xrun_prefix);
+    host->trace_xrun_prefix = path_prefix ? strdup(path_prefix) : NULL;
+    return LV2H_OK;
+}
+
+int lv2h_trace_free(lv2h_t *host) {
+    lv2h_trace_ring_t *ring, *ring_tmp;
+    lv2h_trace_name_t *tname, *tname_tmp;
+    lv2h_trace_stop(host);
+    LL_FOREACH_SAFE(host->trace_ring_list, ring, ring_tmp) {
+        LL_DELETE(host->trace_ring_list, ring);
+        free(ring);
+    }
+    HASH_ITER(hh, host->trace_name_map, tname, tname_tmp) {
+        HASH_DEL(host->trace_name_map, tname);
+        free(tname->name);
+        free(tname);
+    }
+    if (host->trace_xrun_prefix) free(host->trace_xrun_prefix);
+    return LV2H_OK;
+}
+
+int lv2h_trace_register_thread(lv2h_t *host, const char *thread_name) {
+    return lv2h_trace_get_ring(host, thread_name) ? LV2H_OK : LV2H_ERR;
+}
+
+const char *lv2h_trace_intern(lv2h_t *host, const char *name) {
+    lv2h_trace_name_t *tname;
+
+    // Spans may name things that are freed before the rings are dumped
+    pthread_mutex_lock(&host->trace_mutex);
+    HASH_FIND_STR(host->trace_name_map, name, tname);
+    if (!tname && (tname = calloc(1, sizeof(lv2h_trace_name_t)))) {
+        if ((tname->name = strdup(name))) {
+            HASH_ADD_KEYPTR(hh, host->trace_name_map, tname->name, strlen(tname->name), tname);
+        } else {
+            free(tname);
+            tname = NULL;
+        }
+    }
+    pthread_mutex_unlock(&host->trace_mutex);
+    return tname ? tname->name : "plugin";
+}
+
+long lv2h_trace_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+void lv2h_trace_span(lv2h_t *host, const char *name, const void *arg, long begin_ns) {
+    lv2h_trace_ring_t *ring;
+    lv2h_trace_span_t *span;
+    unsigned long head;
+
+    if (!(ring = lv2h_trace_get_ring(host, NULL))) {
+        return;
+    }
+
+    // Flight recorder: the writer never waits and overwrites the oldest span
+    head = ring->head;
+    span = &ring->spans[head & (LV2H_TRACE_RING_SIZE - 1)];
+    span->name = name;
+    span->arg = arg;
+    span->begin_ns = begin_ns;
+    span->end_ns = lv2h_trace_now_ns();
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+int lv2h_trace_dump(lv2h_t *host, char *path) {
+    FILE *fp;
+    lv2h_trace_ring_t *ring;
+    lv2h_trace_span_t span;
+    unsigned long head_before, head_after, i, first;
+    int pid;
+    int n;
+
+    if (!(fp = fopen(path, "w"))) {
+        LV2H_RETURN_ERR(host, "lv2h_trace_dump: could not open %s\n", path);
+    }
+
+    pid = (int)getpid();
+    n = 0;
+    fprintf(fp, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+
+    pthread_mutex_lock(&host->trace_mutex);
+    LL_FOREACH(host->trace_ring_list, ring) {
+        fprintf(fp, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":", n++ ? ",\n" : "", pid, ring->tid);
+        lv2h_trace_write_str(fp, ring->thread_name);
+        fprintf(fp, "}}");
+
+        head_before = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        first = head_before > LV2H_TRACE_RING_SIZE ? head_before - LV2H_TRACE_RING_SIZE : 0;
+        for (i = first; i < head_before; ++i) {
+            span = ring->spans[i & (LV2H_TRACE_RING_SIZE - 1)];
+            // Skip spans the writer may have overwritten while we were reading
+            head_after = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+            if (head_after - i >= LV2H_TRACE_RING_SIZE) continue;
+            fprintf(fp, ",\n{\"name\":");
+            lv2h_trace_write_str(fp, span.name);
+            fprintf(fp, ",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"arg\":\"%p\"}}",
+                pid, ring->tid,
+                (double)span.begin_ns / 1000.0,
+                (double)(span.end_ns - span.begin_ns) / 1000.0,
+                span.arg);
+        }
+    }
+    pthread_mutex_unlock(&host->trace_mutex);
+
+    fprintf(fp, "\n]}\n");
+    fclose(fp);
+    return LV2H_OK;
+}
+
+int lv2h_trace_check_xrun(lv2h_t *host) {
+    char path[PATH_MAX];
+    unsigned long xrun_count;
+    if (!__sync_bool_compare_and_swap(&host->trace_xrun_pending, 1, 0)) {
+        return LV2H_OK;
+    }
+    if (!host->trace_xrun_prefix) {
+        return LV2H_OK;
+    }
+    xrun_count = __sync_fetch_and_add(&host->xrun_count, 0);
+    snprintf(path, sizeof(path), "%s-%lu.json", host->trace_xrun_prefix, xrun_count);
+    return lv2h_trace_dump(host, path);
+}
+
+static lv2h_trace_ring_t *lv2h_trace_get_ring(lv2h_t *host, const char *thread_name) {
+    lv2h_trace_ring_t *ring;
+
+    if (lv2h_trace_thread_host == host && lv2h_trace_thread_ring) {
+        return lv2h_trace_thread_ring;
+    }
+
+    if (!(ring = calloc(1, sizeof(lv2h_trace_ring_t)))) {
+        return NULL;
+    }
+    ring->tid = (int)syscall(SYS_gettid);
+    snprintf(ring->thread_name, sizeof(ring->thread_name), "%s", thread_name ? thread_name : "thread");
+
+    pthread_mutex_lock(&host->trace_mutex);
+    LL_APPEND(host->trace_ring_list, ring);
+    pthread_mutex_unlock(&host->trace_mutex);
+
+    lv2h_trace_thread_host = host;
+    lv2h_trace_thread_ring = ring;
+    return ring;
+}
+
+static void lv2h_trace_write_str(FILE *fp, const char *str) {
+    fputc('"', fp);
+    for (; str && *str; ++str) {
+        if (*str == '"' || *str == '\\') {
+            fputc('\\', fp);
+        }
+        if ((unsigned char)*str >= 0x20) {
+            fputc(*str, fp);
+        }
+    }
+    fputc('"', fp);
+}